@@ -0,0 +1,237 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include "matrix.h"
+#include "multiply.h"
+#include "packed.h"
+#include "executor.h"
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+// Asynchronous multiplies.
+//
+// matmul_async() returns at once with a matmul_future; the product is
+// computed by tasks on an executor (the shared default_executor() unless
+// one is given), so many multiplies can be in flight without a thread each
+// and without running more threads than the executor has.  The future can
+// be waited on with get(), or co_await'ed from a coroutine when built as
+// C++20 (the build in the README uses -std=c++20).
+//
+// Dense products are pipelined by column block of m2, a few packed panels
+// wide (see packed.h):
+//
+//   pack(b) -> compute(b)
+//
+// compute(b) queues pack(b + 1) before it starts, so while one worker
+// multiplies block b another packs block b + 1 and then moves on to
+// multiplying it.  compute(b) applies the epilogue as it stores its columns
+// of the result, like the synchronous kernels.  Narrow and sparse shapes,
+// which matmul() sends to kernels that don't use packed panels, run as a
+// single task.
+//
+// The operands (and any epilogue bias vectors) must stay alive and
+// unchanged until the future is ready.  The result belongs to the caller.
+
+// Completion shared by the tasks of one multiply and its future
+template <class T>
+struct matmul_state {
+  std::mutex lock;
+  std::condition_variable finished;
+  bool done;
+  matrix<T> * result;
+  // Run on the executor once the result is ready (set by co_await)
+  std::function<void()> continuation;
+  executor * exec;
+
+  explicit matmul_state(executor * exec) : done(false), result(nullptr), exec(exec) {}
+
+  void complete(matrix<T> * res) {
+    std::function<void()> next;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      result = res;
+      done = true;
+      next = std::move(continuation);
+    }
+    finished.notify_all();
+    if (next) exec->submit(std::move(next));
+  }
+};
+
+template <class T>
+class matmul_future {
+
+  public:
+    explicit matmul_future(std::shared_ptr<matmul_state<T>> state) : _state(std::move(state)) {}
+
+    bool ready() const {
+      std::lock_guard<std::mutex> guard(_state->lock);
+      return _state->done;
+    }
+
+    void wait() const {
+      std::unique_lock<std::mutex> guard(_state->lock);
+      _state->finished.wait(guard, [this]() { return _state->done; });
+    }
+
+    // Waits for and returns the product.  Don't call this from a task on the
+    // executor computing it; co_await the future there instead.
+    matrix<T> * get() const {
+      wait();
+      return _state->result;
+    }
+
+#if defined(__cpp_impl_coroutine)
+    // co_await suspends until the product is ready and resumes on the executor
+    struct awaiter {
+      std::shared_ptr<matmul_state<T>> state;
+
+      bool await_ready() const {
+        std::lock_guard<std::mutex> guard(state->lock);
+        return state->done;
+      }
+
+      bool await_suspend(std::coroutine_handle<> handle) {
+        std::lock_guard<std::mutex> guard(state->lock);
+        if (state->done) return false;
+        state->continuation = [handle]() { handle.resume(); };
+        return true;
+      }
+
+      matrix<T> * await_resume() const { return state->result; }
+    };
+
+    awaiter operator co_await() const { return awaiter{ _state }; }
+#endif
+
+  private:
+    std::shared_ptr<matmul_state<T>> _state;
+};
+
+// Panels of m2 per pipeline stage.  Each compute stage reads all of m1, so
+// a block is several panels wide; it is narrow enough that a block's depth
+// slice stays in L2 and a product has several stages to overlap.
+const unsigned int pipeline_block_panels = 4;
+
+// State of one pipelined dense multiply
+template <class T>
+struct packed_pipeline {
+  matrix<T> * m1;
+  const matrix<T> * m2;
+  epilogue<T> ep;
+  // Panels are packed into `packing` as the pipeline reaches them, unless
+  // the caller passed an already packed m2
+  std::shared_ptr<packed_matrix<T>> packing;
+  packed_handle<T> packed;
+  matrix<T> * res;
+  std::atomic<unsigned int> remaining;
+  std::shared_ptr<matmul_state<T>> state;
+
+  unsigned int block_count() const {
+    return (packed->panel_count() + pipeline_block_panels - 1) / pipeline_block_panels;
+  }
+};
+
+template <class T>
+void pipeline_compute(std::shared_ptr<packed_pipeline<T>> pipe, unsigned int b);
+
+template <class T>
+void pipeline_pack(std::shared_ptr<packed_pipeline<T>> pipe, unsigned int b) {
+  if (pipe->packing) {
+    const unsigned int p1 = std::min(pipe->packing->panel_count(), (b + 1) * pipeline_block_panels);
+    for (unsigned int p = b * pipeline_block_panels; p < p1; p++) pack_panel(pipe->m2, p, pipe->packing.get());
+  }
+  pipe->state->exec->submit([pipe, b]() { pipeline_compute(pipe, b); });
+}
+
+template <class T>
+void pipeline_compute(std::shared_ptr<packed_pipeline<T>> pipe, unsigned int b) {
+  if (b + 1 < pipe->block_count()) pipe->state->exec->submit([pipe, b]() { pipeline_pack(pipe, b + 1); });
+
+  const unsigned int p1 = std::min(pipe->packed->panel_count(), (b + 1) * pipeline_block_panels);
+  matmul_packed_block(pipe->m1, *pipe->packed, 0, pipe->m1->rows, b * pipeline_block_panels, p1, pipe->res, pipe->ep);
+  if (--pipe->remaining == 0) pipe->state->complete(pipe->res);
+}
+
+// Set up pipe's result and run it under state, from a task on state's executor
+template <class T>
+void start_pipeline(std::shared_ptr<packed_pipeline<T>> pipe, std::shared_ptr<matmul_state<T>> state) {
+  pipe->state = std::move(state);
+  pipe->res = new matrix<T>(pipe->m1->rows, pipe->packed->cols);
+  const unsigned int blocks = pipe->block_count();
+  pipe->remaining = blocks;
+  if (blocks == 0 || pipe->m1->rows == 0) {
+    pipe->state->complete(pipe->res);
+  } else {
+    pipeline_pack(pipe, 0);
+  }
+}
+
+// Multiply m1 by m2 on exec.  The kernel is picked as matmul() would, with
+// dense products going through the pipelined packed kernel.  The choice
+// (which reads part of m1 for the density check) is made by the first
+// task, so the caller never waits on it.
+template <class T>
+matmul_future<T> matmul_async(matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep,
+                              executor & exec = default_executor()) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  auto state = std::make_shared<matmul_state<T>>(&exec);
+  exec.submit([state, m1, m2, ep]() {
+    if (m2->cols <= skinny_max_dim || m1->rows <= skinny_max_dim ||
+        density_at_most(m1, sparse_density_threshold)) {
+      state->complete(matmul(m1, m2, ep));
+      return;
+    }
+
+    auto pipe = std::make_shared<packed_pipeline<T>>();
+    pipe->m1 = m1;
+    pipe->m2 = m2;
+    pipe->ep = ep;
+    unsigned int panel_width, depth_block;
+    const pack_isa isa = best_pack_isa();
+    pack_block_sizes<T>(isa, &panel_width, &depth_block);
+    pipe->packing = std::make_shared<packed_matrix<T>>(m2->rows, m2->cols, isa, panel_width, depth_block);
+    pipe->packed = pipe->packing;
+    start_pipeline(pipe, state);
+  });
+  return matmul_future<T>(state);
+}
+
+template <class T>
+matmul_future<T> matmul_async(matrix<T> * m1, matrix<T> * m2, executor & exec = default_executor()) {
+  return matmul_async(m1, m2, epilogue<T>(), exec);
+}
+
+// Multiply m1 by an already packed m2 on exec; only the compute and
+// epilogue stages run.  The future keeps the handle alive.
+template <class T>
+matmul_future<T> matmul_async(matrix<T> * m1, packed_handle<T> m2, const epilogue<T> & ep,
+                              executor & exec = default_executor()) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  auto pipe = std::make_shared<packed_pipeline<T>>();
+  pipe->m1 = m1;
+  pipe->m2 = nullptr;
+  pipe->ep = ep;
+  pipe->packed = std::move(m2);
+  auto state = std::make_shared<matmul_state<T>>(&exec);
+  exec.submit([pipe, state]() { start_pipeline(pipe, state); });
+  return matmul_future<T>(state);
+}
+
+template <class T>
+matmul_future<T> matmul_async(matrix<T> * m1, packed_handle<T> m2, executor & exec = default_executor()) {
+  return matmul_async(m1, std::move(m2), epilogue<T>(), exec);
+}
+
+#endif //ASYNC_H
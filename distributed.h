@@ -0,0 +1,327 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "matrix.h"
+#include "packed.h"
+#include "transport.h"
+
+// Distributed multiply with SUMMA over a 2D block-cyclic layout.
+//
+// matmul_summa() forks `workers` processes arranged as a grid_rows x
+// grid_cols grid.  Every operand and the result are cut into block_size
+// square blocks, and block (bi, bj) belongs to the worker at grid position
+// (bi % grid_rows, bj % grid_cols).  The calling process scatters every
+// worker's blocks of m1 and m2 to it over the transport, as a multi-machine
+// run would, and everything after that goes through the transport too; the
+// workers never read the inputs they inherit from fork().
+//
+// For every block column k of m1 (block row k of m2), the workers holding
+// it broadcast their part of m1 along their grid row and of m2 along their
+// grid column, and every worker adds the product of the two panels to its
+// blocks of the result.  The broadcast of panel k + 1 runs on a second
+// thread, which also packs the m2 panel (see packed.h), while panel k is
+// multiplied straight out of the receive buffers by the packed kernel and
+// added into the worker's blocks of the result in place, the last panel
+// through the epilogue.  Finally each worker sends its blocks of the result
+// to the calling process, which assembles them.
+//
+// The calling process's threads (e.g. a busy executor) are not carried
+// into the workers, which only use their own.
+//
+// If fork() fails or a worker dies or fails, the calling process aborts the
+// transport (so the remaining workers give up too), reaps every worker,
+// reports the failure on stderr and returns null.  Workers watch the
+// calling process in turn and exit if it goes away.  If the transport
+// can't be set up, nothing is forked and null is returned.
+
+struct summa_config {
+  unsigned int workers;
+  // Process grid; 0 picks the most square grid of `workers` processes
+  unsigned int grid_rows;
+  unsigned int grid_cols;
+  unsigned int block_size;
+  transport_kind kind;
+
+  summa_config() : workers(1), grid_rows(0), grid_cols(0), block_size(64), kind(transport_kind::shared_memory) {}
+  summa_config(unsigned int workers, transport_kind kind)
+    : workers(workers), grid_rows(0), grid_cols(0), block_size(64), kind(kind) {}
+};
+
+// Most square grid_rows x grid_cols factorization of workers
+inline void summa_grid(unsigned int workers, unsigned int * grid_rows, unsigned int * grid_cols) {
+  unsigned int r = (unsigned int) std::sqrt((double) workers);
+  while (r > 1 && workers % r != 0) r--;
+  *grid_rows = r == 0 ? 1 : r;
+  *grid_cols = workers / *grid_rows;
+}
+
+// Elements of a dimension of length n, dealt out in blocks of nb to P
+// processes in turn, that process p holds
+inline unsigned int block_cyclic_extent(unsigned int n, unsigned int nb, unsigned int p, unsigned int P) {
+  unsigned int count = 0;
+  for (unsigned int b = p; b * nb < n; b += P) count += std::min(nb, n - b * nb);
+  return count;
+}
+
+// Global index of local index l on process p
+inline unsigned int block_cyclic_global(unsigned int l, unsigned int nb, unsigned int p, unsigned int P) {
+  return ((l / nb) * P + p) * nb + l % nb;
+}
+
+// Blocks of m held by grid position (pr, pc), row major, local rows by
+// local columns
+template <class T>
+std::vector<T> block_cyclic_local(const matrix<T> * m, unsigned int nb, unsigned int pr, unsigned int grid_rows,
+                                  unsigned int pc, unsigned int grid_cols) {
+  const unsigned int rows = block_cyclic_extent(m->rows, nb, pr, grid_rows);
+  const unsigned int cols = block_cyclic_extent(m->cols, nb, pc, grid_cols);
+  std::vector<T> local((size_t) rows * cols);
+  for (unsigned int i = 0; i < rows; i++) {
+    const unsigned int gi = block_cyclic_global(i, nb, pr, grid_rows);
+    for (unsigned int j = 0; j < cols; j++) local[(size_t) i * cols + j] = m->get(gi, block_cyclic_global(j, nb, pc, grid_cols));
+  }
+  return local;
+}
+
+// Send buf from root to every other rank in group.  False if the transport failed.
+template <class T>
+bool summa_broadcast(transport & t, const std::vector<unsigned int> & group, unsigned int root, std::vector<T> & buf) {
+  if (t.rank() != root) return t.recv(root, buf.data(), buf.size() * sizeof(T));
+  for (unsigned int r : group) {
+    if (r != root && !t.send(r, buf.data(), buf.size() * sizeof(T))) return false;
+  }
+  return true;
+}
+
+// One worker's part of an m x depth by depth x n matmul_summa.  Receives
+// its blocks of the operands from the last rank and stores its blocks of
+// the result in *c_loc, row major, local rows by local columns.  False if
+// the transport failed.
+template <class T>
+bool summa_worker(unsigned int m, unsigned int depth, unsigned int n, const epilogue<T> & ep,
+                  unsigned int grid_rows, unsigned int grid_cols, unsigned int nb, transport & t,
+                  std::vector<T> * c_loc_out) {
+  const unsigned int rank = t.rank();
+  const unsigned int pr = rank / grid_cols;
+  const unsigned int pc = rank % grid_cols;
+  const unsigned int coordinator = t.size() - 1;
+
+  // Local blocks: of m1 (rows from this grid row, columns from this grid
+  // column), of m2 (likewise) and of the result
+  const unsigned int m_loc = block_cyclic_extent(m, nb, pr, grid_rows);
+  const unsigned int n_loc = block_cyclic_extent(n, nb, pc, grid_cols);
+  const unsigned int k1_loc = block_cyclic_extent(depth, nb, pc, grid_cols);
+  const unsigned int k2_loc = block_cyclic_extent(depth, nb, pr, grid_rows);
+  std::vector<T> a_loc((size_t) m_loc * k1_loc), b_loc((size_t) k2_loc * n_loc);
+  if (!t.recv(coordinator, a_loc.data(), a_loc.size() * sizeof(T)) ||
+      !t.recv(coordinator, b_loc.data(), b_loc.size() * sizeof(T))) {
+    return false;
+  }
+  std::vector<T> c_loc((size_t) m_loc * n_loc, T(0));
+
+  // ep with its biases cut down to this worker's rows and columns, so it
+  // can be applied with local indices
+  epilogue<T> local_ep = ep;
+  std::vector<T> row_bias, col_bias;
+  if (ep.row_bias != nullptr) {
+    for (unsigned int i = 0; i < m_loc; i++) row_bias.push_back((*ep.row_bias)[block_cyclic_global(i, nb, pr, grid_rows)]);
+    local_ep.row_bias = &row_bias;
+  }
+  if (ep.col_bias != nullptr) {
+    for (unsigned int j = 0; j < n_loc; j++) col_bias.push_back((*ep.col_bias)[block_cyclic_global(j, nb, pc, grid_cols)]);
+    local_ep.col_bias = &col_bias;
+  }
+
+  std::vector<unsigned int> my_row, my_col;
+  for (unsigned int c = 0; c < grid_cols; c++) my_row.push_back(pr * grid_cols + c);
+  for (unsigned int r = 0; r < grid_rows; r++) my_col.push_back(r * grid_cols + pc);
+
+  // Panel kb: block column kb of m1 restricted to this grid row, and block
+  // row kb of m2 restricted to this grid column
+  unsigned int panel_width, depth_block;
+  const pack_isa isa = best_pack_isa();
+  pack_block_sizes<T>(isa, &panel_width, &depth_block);
+  struct panels {
+    std::vector<T> a, b;
+    std::unique_ptr<packed_matrix<T>> packed_b;
+    unsigned int width;
+    bool ok;
+  };
+  auto fetch = [&](unsigned int kb, panels & p) {
+    p.width = std::min(nb, depth - kb * nb);
+    p.a.resize((size_t) m_loc * p.width);
+    p.b.resize((size_t) p.width * n_loc);
+    const unsigned int a_owner = kb % grid_cols;
+    const unsigned int b_owner = kb % grid_rows;
+    if (pc == a_owner) {
+      const unsigned int k0 = (kb / grid_cols) * nb;
+      for (unsigned int i = 0; i < m_loc; i++) {
+        for (unsigned int k = 0; k < p.width; k++) p.a[(size_t) i * p.width + k] = a_loc[(size_t) i * k1_loc + k0 + k];
+      }
+    }
+    if (pr == b_owner) {
+      const unsigned int k0 = (kb / grid_rows) * nb;
+      std::copy(b_loc.begin() + (size_t) k0 * n_loc, b_loc.begin() + (size_t) (k0 + p.width) * n_loc, p.b.begin());
+    }
+    // Every worker broadcasts in the same order, m1 panels first
+    p.ok = summa_broadcast(t, my_row, pr * grid_cols + a_owner, p.a) &&
+           summa_broadcast(t, my_col, b_owner * grid_cols + pc, p.b);
+    if (!p.ok) return;
+    // Only the last panel can be narrower, so the buffer is rarely rebuilt
+    if (!p.packed_b || p.packed_b->rows != p.width) {
+      p.packed_b.reset(new packed_matrix<T>(p.width, n_loc, isa, panel_width, depth_block));
+    }
+    pack_buffer(p.b.data(), n_loc, p.packed_b.get());
+  };
+
+  const unsigned int k_blocks = (depth + nb - 1) / nb;
+  panels buffers[2];
+  if (k_blocks > 0) fetch(0, buffers[0]);
+  for (unsigned int kb = 0; kb < k_blocks; kb++) {
+    // Bring in the next panels while this one is multiplied
+    std::thread next;
+    if (kb + 1 < k_blocks) next = std::thread(fetch, kb + 1, std::ref(buffers[(kb + 1) % 2]));
+
+    panels & p = buffers[kb % 2];
+    if (!p.ok) {
+      if (next.joinable()) next.join();
+      return false;
+    }
+    // The last panel finishes the result, so it stores through the epilogue
+    if (m_loc > 0 && n_loc > 0) {
+      matmul_packed_acc(p.a.data(), p.width, m_loc, *p.packed_b, c_loc.data(), n_loc,
+                        kb + 1 == k_blocks ? local_ep : epilogue<T>());
+    }
+    if (next.joinable()) next.join();
+  }
+  if (k_blocks == 0) {
+    for (unsigned int i = 0; i < m_loc; i++) {
+      for (unsigned int j = 0; j < n_loc; j++) c_loc[(size_t) i * n_loc + j] = local_ep.apply(T(0), i, j);
+    }
+  }
+  c_loc_out->swap(c_loc);
+  return true;
+}
+
+// Multiply m1 by m2 with config.workers worker processes, see above
+template <class T>
+matrix<T> * matmul_summa(matrix<T> * m1, matrix<T> * m2, const summa_config & config, const epilogue<T> & ep) {
+  static_assert(std::is_trivially_copyable<T>::value, "elements are sent as raw bytes");
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(config.workers > 0 && config.block_size > 0);
+
+  unsigned int grid_rows = config.grid_rows, grid_cols = config.grid_cols;
+  if (grid_rows == 0 || grid_cols == 0) summa_grid(config.workers, &grid_rows, &grid_cols);
+  assert(grid_rows * grid_cols == config.workers);
+  const unsigned int nb = config.block_size;
+
+  // Endpoints 0 .. workers - 1 are the workers, the last is this process
+  auto t = make_transport(config.kind, config.workers + 1);
+  if (!t) return nullptr;
+  const pid_t coordinator = getpid();
+  std::cout << std::flush;
+  std::vector<pid_t> pids;
+  bool failed = false;
+  for (unsigned int w = 0; w < config.workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "matmul_summa: fork failed: " << std::strerror(errno) << std::endl;
+      failed = true;
+      break;
+    }
+    if (pid == 0) {
+      t->attach(w);
+      // Give up if the calling process goes away
+      t->watch([coordinator]() { return getppid() == coordinator; });
+      // The workers share this machine's cores
+      parallel_thread_limit() = std::max(1u, hardware_threads() / config.workers);
+      std::vector<T> c_loc;
+      const bool ok = summa_worker(m1->rows, m1->cols, m2->cols, ep, grid_rows, grid_cols, nb, *t, &c_loc) &&
+                      t->send(config.workers, c_loc.data(), c_loc.size() * sizeof(T));
+      // Skip static destructors and atexit handlers inherited from the parent
+      _exit(ok ? 0 : 1);
+    }
+    pids.push_back(pid);
+  }
+  t->attach(config.workers);
+
+  // Reap workers as they exit; any that didn't exit cleanly fails the multiply
+  std::vector<bool> reaped(pids.size(), false);
+  bool reported = failed;
+  auto reap = [&](bool block) {
+    for (size_t w = 0; w < pids.size(); w++) {
+      if (reaped[w]) continue;
+      int status = 0;
+      pid_t rc;
+      do {
+        rc = waitpid(pids[w], &status, block ? 0 : WNOHANG);
+      } while (rc < 0 && errno == EINTR);
+      if (rc == 0) continue;
+      reaped[w] = true;
+      if (rc < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        // Only the first; the others fail because the transport was aborted
+        if (!reported) std::cerr << "matmul_summa: worker " << w << " failed" << std::endl;
+        reported = true;
+        failed = true;
+      }
+    }
+    return !failed;
+  };
+  t->watch([&reap]() { return reap(false); });
+
+  // Scatter: each worker's blocks of m1, then of m2
+  for (unsigned int w = 0; w < pids.size() && !failed; w++) {
+    const unsigned int pr = w / grid_cols, pc = w % grid_cols;
+    const std::vector<T> a_loc = block_cyclic_local(m1, nb, pr, grid_rows, pc, grid_cols);
+    const std::vector<T> b_loc = block_cyclic_local(m2, nb, pr, grid_rows, pc, grid_cols);
+    if (!t->send(w, a_loc.data(), a_loc.size() * sizeof(T)) || !t->send(w, b_loc.data(), b_loc.size() * sizeof(T))) {
+      failed = true;
+    }
+  }
+
+  auto res = new matrix<T>(m1->rows, m2->cols);
+  for (unsigned int w = 0; w < pids.size() && !failed; w++) {
+    const unsigned int pr = w / grid_cols, pc = w % grid_cols;
+    const unsigned int m_loc = block_cyclic_extent(m1->rows, nb, pr, grid_rows);
+    const unsigned int n_loc = block_cyclic_extent(m2->cols, nb, pc, grid_cols);
+    std::vector<T> c_loc((size_t) m_loc * n_loc);
+    if (!t->recv(w, c_loc.data(), c_loc.size() * sizeof(T))) {
+      failed = true;
+      break;
+    }
+    for (unsigned int i = 0; i < m_loc; i++) {
+      for (unsigned int j = 0; j < n_loc; j++) {
+        res->set(block_cyclic_global(i, nb, pr, grid_rows), block_cyclic_global(j, nb, pc, grid_cols),
+                 c_loc[(size_t) i * n_loc + j]);
+      }
+    }
+  }
+  // Make the remaining workers give up, then wait for all of them
+  if (failed) t->abort();
+  reap(true);
+  if (failed) {
+    if (!reported) std::cerr << "matmul_summa: transport failed" << std::endl;
+    delete res;
+    return nullptr;
+  }
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_summa(matrix<T> * m1, matrix<T> * m2, const summa_config & config) {
+  return matmul_summa(m1, m2, config, epilogue<T>());
+}
+
+#endif //DISTRIBUTED_H
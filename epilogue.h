@@ -0,0 +1,126 @@
+#ifndef EPILOGUE_H
+#define EPILOGUE_H
+
+#include <vector>
+#include <cmath>
+#include <x86intrin.h>
+
+// Elementwise functions an epilogue can finish with
+enum class activation { none, relu, gelu, clamp };
+
+// Work applied to each element of a product before it is stored:
+//
+//   res[i][j] = act(alpha * acc + row_bias[i] + col_bias[j])
+//
+// Every kernel that takes an epilogue applies it to the accumulator while
+// it is still in a register, so scaling, bias and activation cost no extra
+// pass over the result.  Out is the result's element type: store()
+// finishes an accumulator and converts it to Out as the last step, so the
+// _narrow half precision kernels take an epilogue<float, float16> (or
+// bfloat16) and round only once, after the fp32 arithmetic.  Those are the
+// only kernels whose output type differs from their input type; every
+// other kernel, and matmul(), takes an epilogue<T> with Out = T.
+//
+// The bias vectors are borrowed, not copied, and must outlive the multiply.
+// Either may be left null.
+template <class T, class Out = T>
+struct epilogue {
+  T alpha;
+  const std::vector<T> * row_bias;
+  const std::vector<T> * col_bias;
+  activation act;
+  T clamp_min;
+  T clamp_max;
+
+  // The default epilogue stores the accumulator unchanged
+  epilogue() : alpha(1), row_bias(nullptr), col_bias(nullptr), act(activation::none), clamp_min(0), clamp_max(0) {}
+
+  // The same work, stored into another output type.  Explicit, so an
+  // epilogue meant for a narrowing kernel is never quietly used by one that
+  // stores T.
+  template <class O>
+  explicit epilogue(const epilogue<T, O> & other)
+    : alpha(other.alpha), row_bias(other.row_bias), col_bias(other.col_bias), act(other.act),
+      clamp_min(other.clamp_min), clamp_max(other.clamp_max) {}
+
+  // True when apply() would return its input unchanged
+  bool is_identity() const {
+    return alpha == T(1) && row_bias == nullptr && col_bias == nullptr && act == activation::none;
+  }
+
+  // Finish one accumulator for element (row, col).  The arithmetic happens
+  // in the accumulator's type, so integer kernels don't truncate early.
+  template <class A>
+  A apply(A acc, unsigned int row, unsigned int col) const {
+    if (alpha != T(1)) acc = acc * alpha;
+    if (row_bias != nullptr) acc = acc + (*row_bias)[row];
+    if (col_bias != nullptr) acc = acc + (*col_bias)[col];
+    switch (act) {
+      case activation::none:
+        break;
+      case activation::relu:
+        if (acc < A(0)) acc = A(0);
+        break;
+      case activation::gelu:
+        acc = A(gelu(double(acc)));
+        break;
+      case activation::clamp:
+        if (acc < A(clamp_min)) acc = A(clamp_min);
+        if (acc > A(clamp_max)) acc = A(clamp_max);
+        break;
+    }
+    return acc;
+  }
+
+  // apply(), then convert to the output type
+  template <class A>
+  Out store(A acc, unsigned int row, unsigned int col) const {
+    return Out(apply(acc, row, col));
+  }
+
+  // tanh approximation of GELU, as used by most ML frameworks
+  static double gelu(double x) {
+    return 0.5 * x * (1.0 + std::tanh(0.7978845608028654 * (x + 0.044715 * x * x * x)));
+  }
+};
+
+// Eight wide version of epilogue<float>::apply for the kernels that build up
+// whole strips of a result row in a YMM register.  The strip covers columns
+// col to col + width - 1 of row `row`; lanes past width are don't-cares.
+inline __m256 epilogue_apply_ps(const epilogue<float> & ep, __m256 acc,
+                                unsigned int row, unsigned int col, unsigned int width) {
+  if (ep.is_identity()) return acc;
+  if (ep.alpha != 1.0f) acc = _mm256_mul_ps(acc, _mm256_set1_ps(ep.alpha));
+  if (ep.row_bias != nullptr) acc = _mm256_add_ps(acc, _mm256_set1_ps((*ep.row_bias)[row]));
+  if (ep.col_bias != nullptr) {
+    const float * bias = ep.col_bias->data() + col;
+    if (width == 8) {
+      acc = _mm256_add_ps(acc, _mm256_loadu_ps(bias));
+    } else {
+      float buf[8] = { 0 };
+      for (unsigned int w = 0; w < width; w++) buf[w] = bias[w];
+      acc = _mm256_add_ps(acc, _mm256_loadu_ps(buf));
+    }
+  }
+  switch (ep.act) {
+    case activation::none:
+      break;
+    case activation::relu:
+      acc = _mm256_max_ps(acc, _mm256_setzero_ps());
+      break;
+    case activation::clamp:
+      acc = _mm256_min_ps(_mm256_max_ps(acc, _mm256_set1_ps(ep.clamp_min)), _mm256_set1_ps(ep.clamp_max));
+      break;
+    case activation::gelu: {
+      // No vector tanh in AVX; spill the lanes to the stack (still in L1)
+      float buf[8];
+      _mm256_storeu_ps(buf, acc);
+      for (unsigned int w = 0; w < 8; w++) buf[w] = (float) epilogue<float>::gelu(buf[w]);
+      acc = _mm256_loadu_ps(buf);
+      break;
+    }
+  }
+  return acc;
+}
+
+#endif //EPILOGUE_H
@@ -0,0 +1,80 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "parallel.h"
+
+// Fixed pool of worker threads running submitted tasks in FIFO order.
+//
+// The asynchronous multiplies (see async.h) break each product into small
+// tasks and queue them here, so any number of outstanding multiplies share
+// one set of threads instead of each spawning its own.  Tasks must not
+// block waiting on other tasks of the same executor.  A kernel called from
+// a task runs on the task's thread alone: the pool already has a thread per
+// core, so kernels that would split their work across threads don't.
+class executor {
+
+  public:
+    explicit executor(unsigned int threads = hardware_threads()) : _stopping(false) {
+      if (threads == 0) threads = 1;
+      for (unsigned int t = 0; t < threads; t++) _workers.emplace_back([this]() { _run(); });
+    }
+
+    // Runs whatever is still queued, then joins the workers
+    ~executor() {
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+      }
+      _wake.notify_all();
+      for (auto & w : _workers) w.join();
+    }
+
+    executor(const executor &) = delete;
+    executor & operator=(const executor &) = delete;
+
+    void submit(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _tasks.push_back(std::move(task));
+      }
+      _wake.notify_one();
+    }
+
+    unsigned int size() const { return _workers.size(); }
+
+  private:
+    void _run() {
+      parallel_thread_limit() = 1;
+      for (;;) {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> guard(_lock);
+          _wake.wait(guard, [this]() { return _stopping || !_tasks.empty(); });
+          if (_tasks.empty()) return;
+          task = std::move(_tasks.front());
+          _tasks.pop_front();
+        }
+        task();
+      }
+    }
+
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _lock;
+    std::condition_variable _wake;
+    bool _stopping;
+};
+
+// The library's shared executor, one worker per hardware thread
+inline executor & default_executor() {
+  static executor pool;
+  return pool;
+}
+
+#endif //EXECUTOR_H
@@ -0,0 +1,334 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include "matrix.h"
+#include "multiply.h"
+#include "triangular.h"
+
+// Lazy matrix expressions.
+//
+// A * B * C + D builds a small tree of expression objects instead of
+// running any multiplies.  Nothing is computed until the tree is handed to
+// evaluate(), which then:
+//
+//  - flattens every run of products into a chain and picks the cheapest
+//    order to multiply it in (dynamic programming on the shapes), so
+//    A * B * C * x costs three matrix-vector products, not two full
+//    matrix products and a matrix-vector product;
+//  - folds transpose() into the leaves.  A transposed operand is read from
+//    the other one of matrix's two copies (row major / column major), so
+//    no transpose is ever performed, and every product still runs on the
+//    kernel matmul() picks;
+//  - stores the final product in the destination's own rows, and adds
+//    sums into them in place.  Each product is computed by a kernel into
+//    a temporary first; chains longer than two also keep their partial
+//    products.
+//
+// Expressions hold pointers to the matrices they were built from, so those
+// must outlive the expression.
+
+template <class T> struct mat_view;
+template <class L, class R> struct mul_expr;
+template <class L, class R> struct add_expr;
+
+// A leaf: a matrix, possibly transposed
+template <class T>
+struct mat_view {
+  typedef T value_type;
+
+  const matrix<T> * m;
+  bool trans;
+
+  mat_view(const matrix<T> * m, bool trans) : m(m), trans(trans) {}
+
+  unsigned int rows() const { return trans ? m->cols : m->rows; }
+  unsigned int cols() const { return trans ? m->rows : m->cols; }
+};
+
+template <class L, class R>
+struct mul_expr {
+  typedef typename L::value_type value_type;
+
+  L lhs;
+  R rhs;
+
+  mul_expr(const L & lhs, const R & rhs) : lhs(lhs), rhs(rhs) {
+    // Make sure that matrices match 1's cols to 2's rows
+    assert(lhs.cols() == rhs.rows());
+  }
+
+  unsigned int rows() const { return lhs.rows(); }
+  unsigned int cols() const { return rhs.cols(); }
+};
+
+template <class L, class R>
+struct add_expr {
+  typedef typename L::value_type value_type;
+
+  L lhs;
+  R rhs;
+
+  add_expr(const L & lhs, const R & rhs) : lhs(lhs), rhs(rhs) {
+    assert(lhs.rows() == rhs.rows() && lhs.cols() == rhs.cols());
+  }
+
+  unsigned int rows() const { return lhs.rows(); }
+  unsigned int cols() const { return lhs.cols(); }
+};
+
+// Maps anything that can appear in an expression to its node type.
+// A plain matrix<T> becomes an untransposed leaf.
+template <class E> struct expr_node { };
+template <class T> struct expr_node<matrix<T>> { typedef mat_view<T> type; };
+template <class T> struct expr_node<mat_view<T>> { typedef mat_view<T> type; };
+template <class L, class R> struct expr_node<mul_expr<L, R>> { typedef mul_expr<L, R> type; };
+template <class L, class R> struct expr_node<add_expr<L, R>> { typedef add_expr<L, R> type; };
+
+template <class E, class = void> struct is_matrix_expr : std::false_type { };
+template <class E> struct is_matrix_expr<E, std::void_t<typename expr_node<E>::type>> : std::true_type { };
+
+template <class T>
+mat_view<T> as_expr(const matrix<T> & m) { return mat_view<T>(&m, false); }
+template <class E>
+const E & as_expr(const E & e) { return e; }
+
+template <class A, class B,
+          class = std::enable_if_t<is_matrix_expr<A>::value && is_matrix_expr<B>::value>>
+mul_expr<typename expr_node<A>::type, typename expr_node<B>::type> operator*(const A & a, const B & b) {
+  return mul_expr<typename expr_node<A>::type, typename expr_node<B>::type>(as_expr(a), as_expr(b));
+}
+
+template <class A, class B,
+          class = std::enable_if_t<is_matrix_expr<A>::value && is_matrix_expr<B>::value>>
+add_expr<typename expr_node<A>::type, typename expr_node<B>::type> operator+(const A & a, const B & b) {
+  return add_expr<typename expr_node<A>::type, typename expr_node<B>::type>(as_expr(a), as_expr(b));
+}
+
+// Transposed views.  These push the transpose down to the leaves:
+// (AB)' = B'A' and (A + B)' = A' + B'.
+template <class T>
+mat_view<T> transpose(const matrix<T> & m) { return mat_view<T>(&m, true); }
+
+template <class T>
+mat_view<T> transpose(const mat_view<T> & v) { return mat_view<T>(v.m, !v.trans); }
+
+template <class L, class R>
+auto transpose(const mul_expr<L, R> & e) {
+  auto lhs = transpose(e.rhs);
+  auto rhs = transpose(e.lhs);
+  return mul_expr<decltype(lhs), decltype(rhs)>(lhs, rhs);
+}
+
+template <class L, class R>
+auto transpose(const add_expr<L, R> & e) {
+  auto lhs = transpose(e.lhs);
+  auto rhs = transpose(e.rhs);
+  return add_expr<decltype(lhs), decltype(rhs)>(lhs, rhs);
+}
+
+// op(m1) * op(m2) into a new matrix, where op transposes when the matching
+// flag is set.  The kernels read rows of m1 from the row major copy and
+// columns of m2 from the column major copy, and the transpose of a matrix
+// is the same two copies with their roles traded, so a transposed operand
+// is handed to matmul() as a stand in that borrows them.  Every product
+// goes through matmul()'s kernel choice (packed, sparse or skinny) and
+// nothing is transposed or copied on the way in.  A matrix times its own
+// transpose is symmetric and goes to matmul_syrk instead (see triangular.h).
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_transposed(const matrix<T> * m1, bool trans1, const matrix<T> * m2, bool trans2) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert((trans1 ? m1->rows : m1->cols) == (trans2 ? m2->cols : m2->rows));
+
+  if (m1 == m2 && trans1 != trans2) return matmul_syrk(const_cast<matrix<T> *>(m1), trans1);
+
+  // The kernels only read their operands
+  matrix<T> view1(0, 0), view2(0, 0);
+  matrix<T> * a = const_cast<matrix<T> *>(m1);
+  matrix<T> * b = const_cast<matrix<T> *>(m2);
+  if (trans1) {
+    view1._internal_borrow_transpose(m1);
+    a = &view1;
+  }
+  if (trans2) {
+    view2._internal_borrow_transpose(m2);
+    b = &view2;
+  }
+  // The views leave the borrowed storage alone when they go out of scope
+  return matmul(a, b);
+}
+
+// res = op(m1) * op(m2), or res += op(m1) * op(m2) when accumulate is set.
+// The product is computed by matmul_transposed into a temporary and then
+// copied (or added) into res's own rows, so res keeps the storage and
+// placement (see placement.h) it was built with.  res must already have the
+// right shape and must not be m1 or m2.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+void matmul_into(const matrix<T> * m1, bool trans1, const matrix<T> * m2, bool trans2,
+                 matrix<T> * res, bool accumulate) {
+  assert(res->rows == (trans1 ? m1->cols : m1->rows) && res->cols == (trans2 ? m2->rows : m2->cols));
+  assert(res != m1 && res != m2);
+
+  matrix<T> * product = matmul_transposed(m1, trans1, m2, trans2);
+  for (unsigned int i = 0; i < res->rows; i++) {
+    T * dest = (*res->_elements)[i].data();
+    const T * src = (*product->_elements)[i].data();
+    for (unsigned int j = 0; j < res->cols; j++) dest[j] = accumulate ? T(dest[j] + src[j]) : src[j];
+  }
+  for (unsigned int j = 0; j < res->cols; j++) {
+    T * dest = (*res->_elements_col_maj)[j].data();
+    const T * src = (*product->_elements_col_maj)[j].data();
+    for (unsigned int i = 0; i < res->rows; i++) dest[i] = accumulate ? T(dest[i] + src[i]) : src[i];
+  }
+  delete product;
+}
+
+// Cheapest order to multiply a chain of matrices.  Factor i is
+// dims[i] x dims[i + 1].  Returns split, where the best way to compute
+// factors i..j is (i..split[i][j]) * (split[i][j] + 1..j), and stores the
+// number of multiply-adds that order costs in *cost.
+inline std::vector<std::vector<unsigned int>> optimal_chain_order(const std::vector<unsigned int> & dims,
+                                                                  double * cost) {
+  const unsigned int n = dims.size() - 1;
+  std::vector<std::vector<double>> best(n, std::vector<double>(n, 0.0));
+  std::vector<std::vector<unsigned int>> split(n, std::vector<unsigned int>(n, 0));
+  for (unsigned int len = 2; len <= n; len++) {
+    for (unsigned int i = 0; i + len <= n; i++) {
+      unsigned int j = i + len - 1;
+      best[i][j] = std::numeric_limits<double>::infinity();
+      for (unsigned int s = i; s < j; s++) {
+        double c = best[i][s] + best[s + 1][j] + (double) dims[i] * dims[s + 1] * dims[j + 1];
+        if (c < best[i][j]) {
+          best[i][j] = c;
+          split[i][j] = s;
+        }
+      }
+    }
+  }
+  if (cost != nullptr) *cost = best[0][n - 1];
+  return split;
+}
+
+template <class T> void eval_into(const mat_view<T> & e, matrix<T> * dest, bool accumulate);
+template <class L, class R> void eval_into(const mul_expr<L, R> & e, matrix<typename L::value_type> * dest, bool accumulate);
+template <class L, class R> void eval_into(const add_expr<L, R> & e, matrix<typename L::value_type> * dest, bool accumulate);
+
+// A product chain flattened into its factors.  Factors that are not leaves
+// (sums inside a product) are evaluated into temporaries owned by the chain.
+template <class T>
+struct expr_chain {
+  std::vector<mat_view<T>> factors;
+  std::vector<std::unique_ptr<matrix<T>>> temps;
+};
+
+template <class T>
+void collect(const mat_view<T> & e, expr_chain<T> & chain) {
+  chain.factors.push_back(e);
+}
+
+template <class L, class R>
+void collect(const mul_expr<L, R> & e, expr_chain<typename L::value_type> & chain) {
+  collect(e.lhs, chain);
+  collect(e.rhs, chain);
+}
+
+template <class L, class R>
+void collect(const add_expr<L, R> & e, expr_chain<typename L::value_type> & chain) {
+  auto temp = new matrix<typename L::value_type>(e.rows(), e.cols());
+  eval_into(e, temp, false);
+  chain.temps.emplace_back(temp);
+  chain.factors.push_back(mat_view<typename L::value_type>(temp, false));
+}
+
+// Multiply factors i..j in the order given by split.  The outermost
+// product goes to dest; inner products go to new temporaries in the chain.
+template <class T>
+mat_view<T> eval_chain(expr_chain<T> & chain, const std::vector<std::vector<unsigned int>> & split,
+                       unsigned int i, unsigned int j, matrix<T> * dest, bool accumulate) {
+  if (i == j) return chain.factors[i];
+
+  unsigned int s = split[i][j];
+  mat_view<T> lhs = eval_chain<T>(chain, split, i, s, nullptr, false);
+  mat_view<T> rhs = eval_chain<T>(chain, split, s + 1, j, nullptr, false);
+  if (dest == nullptr) {
+    dest = matmul_transposed(lhs.m, lhs.trans, rhs.m, rhs.trans);
+    chain.temps.emplace_back(dest);
+  } else {
+    matmul_into(lhs.m, lhs.trans, rhs.m, rhs.trans, dest, accumulate);
+  }
+  return mat_view<T>(dest, false);
+}
+
+template <class T>
+void eval_into(const mat_view<T> & e, matrix<T> * dest, bool accumulate) {
+  for (unsigned int i = 0; i < dest->rows; i++) {
+    for (unsigned int j = 0; j < dest->cols; j++) {
+      T val = e.trans ? e.m->get(j, i) : e.m->get(i, j);
+      if (accumulate) val = val + dest->get(i, j);
+      dest->set(i, j, val);
+    }
+  }
+}
+
+template <class L, class R>
+void eval_into(const mul_expr<L, R> & e, matrix<typename L::value_type> * dest, bool accumulate) {
+  expr_chain<typename L::value_type> chain;
+  collect(e, chain);
+
+  std::vector<unsigned int> dims;
+  for (auto & f : chain.factors) dims.push_back(f.rows());
+  dims.push_back(chain.factors.back().cols());
+
+  auto split = optimal_chain_order(dims, nullptr);
+  eval_chain(chain, split, 0, chain.factors.size() - 1, dest, accumulate);
+}
+
+template <class L, class R>
+void eval_into(const add_expr<L, R> & e, matrix<typename L::value_type> * dest, bool accumulate) {
+  eval_into(e.lhs, dest, accumulate);
+  eval_into(e.rhs, dest, true);
+}
+
+// Whether any leaf of the expression is m
+template <class T>
+bool refers_to(const mat_view<T> & e, const matrix<T> * m) { return e.m == m; }
+
+template <class L, class R, class T>
+bool refers_to(const mul_expr<L, R> & e, const matrix<T> * m) { return refers_to(e.lhs, m) || refers_to(e.rhs, m); }
+
+template <class L, class R, class T>
+bool refers_to(const add_expr<L, R> & e, const matrix<T> * m) { return refers_to(e.lhs, m) || refers_to(e.rhs, m); }
+
+// Compute the expression into dest, which must already have its shape.
+// If dest is also an operand the result is built in a temporary first.
+template <class E, class = std::enable_if_t<is_matrix_expr<E>::value>>
+void evaluate(const E & e, matrix<typename expr_node<E>::type::value_type> * dest) {
+  typedef typename expr_node<E>::type::value_type T;
+  const auto & node = as_expr(e);
+  assert(dest->rows == node.rows() && dest->cols == node.cols());
+
+  if (!refers_to(node, dest)) {
+    eval_into(node, dest, false);
+    return;
+  }
+  matrix<T> temp(dest->rows, dest->cols);
+  eval_into(node, &temp, false);
+  eval_into(mat_view<T>(&temp, false), dest, false);
+}
+
+// Compute the expression into a new matrix
+template <class E, class = std::enable_if_t<is_matrix_expr<E>::value>>
+matrix<typename expr_node<E>::type::value_type> * evaluate(const E & e) {
+  const auto & node = as_expr(e);
+  auto res = new matrix<typename expr_node<E>::type::value_type>(node.rows(), node.cols());
+  eval_into(node, res, false);
+  return res;
+}
+
+#endif //EXPR_H
@@ -0,0 +1,184 @@
+#include "matrix.h"
+
+// Kernels for the 16 bit storage types in half.h.  Operands are stored at
+// half width and widened to fp32 as they are loaded into YMM/ZMM registers,
+// so the multiply moves half the bytes of the matrix<float> kernels while
+// still accumulating at full precision.  The epilogue runs on the fp32
+// accumulator; the _narrow kernels convert to 16 bits after it.
+//
+// F16C and AVX512-BF16 are not part of the default build flags, so the
+// functions that use them carry their own target attribute and are only
+// called after checking the CPU supports them.
+
+static bool f16c_supported() {
+  static const bool supported = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("fma");
+  return supported;
+}
+
+static bool avx2_supported() {
+  static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+}
+
+static bool avx512bf16_supported() {
+  static const bool supported = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bf16");
+  return supported;
+}
+
+// Plain scalar dot product, used for tails and on CPUs without the extensions
+template <class T>
+static float dot_scalar(const T * a, const T * b, unsigned int n) {
+  float acc = 0;
+  for (unsigned int k = 0; k < n; k++) {
+    acc += float(a[k]) * float(b[k]);
+  }
+  return acc;
+}
+
+// _mm256_cvtph_ps widens eight halves to eight floats in one instruction
+__attribute__((target("avx,fma,f16c")))
+static float dot_f16c(const float16 * a, const float16 * b, unsigned int n) {
+  __m256 sum = _mm256_setzero_ps();
+  unsigned int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 a_seg = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i_u *) (a + k)));
+    __m256 b_seg = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i_u *) (b + k)));
+    sum = _mm256_fmadd_ps(a_seg, b_seg, sum);
+  }
+  float buf[8];
+  _mm256_storeu_ps(buf, sum);
+  float acc = buf[0] + buf[1] + buf[2] + buf[3] + buf[4] + buf[5] + buf[6] + buf[7];
+  return acc + dot_scalar(a + k, b + k, n - k);
+}
+
+// A bfloat16 is the high half of a float: zero extend to 32 bits and
+// shift left by 16 to get the fp32 bit pattern back.
+__attribute__((target("avx2,fma")))
+static float dot_bf16_avx2(const bfloat16 * a, const bfloat16 * b, unsigned int n) {
+  __m256 sum = _mm256_setzero_ps();
+  unsigned int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i a_bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i_u *) (a + k)));
+    __m256i b_bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i_u *) (b + k)));
+    __m256 a_seg = _mm256_castsi256_ps(_mm256_slli_epi32(a_bits, 16));
+    __m256 b_seg = _mm256_castsi256_ps(_mm256_slli_epi32(b_bits, 16));
+    sum = _mm256_fmadd_ps(a_seg, b_seg, sum);
+  }
+  float buf[8];
+  _mm256_storeu_ps(buf, sum);
+  float acc = buf[0] + buf[1] + buf[2] + buf[3] + buf[4] + buf[5] + buf[6] + buf[7];
+  return acc + dot_scalar(a + k, b + k, n - k);
+}
+
+// _mm512_dpbf16_ps multiplies pairs of bf16 and accumulates into fp32,
+// consuming 32 elements of each operand per instruction.
+__attribute__((target("avx2,fma,avx512f,avx512bf16")))
+static float dot_bf16_avx512(const bfloat16 * a, const bfloat16 * b, unsigned int n) {
+  __m512 sum = _mm512_setzero_ps();
+  unsigned int k = 0;
+  for (; k + 32 <= n; k += 32) {
+    __m512bh a_seg = (__m512bh) _mm512_loadu_si512((const void *) (a + k));
+    __m512bh b_seg = (__m512bh) _mm512_loadu_si512((const void *) (b + k));
+    sum = _mm512_dpbf16_ps(sum, a_seg, b_seg);
+  }
+  return _mm512_reduce_add_ps(sum) + dot_bf16_avx2(a + k, b + k, n - k);
+}
+
+static float dot_f16(const float16 * a, const float16 * b, unsigned int n) {
+  if (f16c_supported()) return dot_f16c(a, b, n);
+  return dot_scalar(a, b, n);
+}
+
+static float dot_bf16(const bfloat16 * a, const bfloat16 * b, unsigned int n) {
+  if (avx512bf16_supported()) return dot_bf16_avx512(a, b, n);
+  if (avx2_supported()) return dot_bf16_avx2(a, b, n);
+  return dot_scalar(a, b, n);
+}
+
+matrix<float> * matmul_cpu_f16c(matrix<float16> * m1, matrix<float16> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  for (int i = 0; i < m1->rows; i++) {
+    const float16 * m1_row = m1->_elements->at(i).data();
+    for (int j = 0; j < m2->cols; j++) {
+      const float16 * m2_col = m2->_elements_col_maj->at(j).data();
+      const auto val = ep.apply(dot_f16(m1_row, m2_col, m1->cols), i, j);
+      res->_elements->at(i)[j] = val;
+      res->_elements_col_maj->at(j)[i] = val;
+    }
+  }
+  return res;
+}
+
+matrix<float> * matmul_cpu_f16c(matrix<float16> * m1, matrix<float16> * m2) {
+  return matmul_cpu_f16c(m1, m2, epilogue<float>());
+}
+
+matrix<float16> * matmul_cpu_f16c_narrow(matrix<float16> * m1, matrix<float16> * m2, const epilogue<float, float16> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<float16>(m1->rows, m2->cols);
+  for (int i = 0; i < m1->rows; i++) {
+    const float16 * m1_row = m1->_elements->at(i).data();
+    for (int j = 0; j < m2->cols; j++) {
+      const float16 * m2_col = m2->_elements_col_maj->at(j).data();
+      const auto val = ep.store(dot_f16(m1_row, m2_col, m1->cols), i, j);
+      res->_elements->at(i)[j] = val;
+      res->_elements_col_maj->at(j)[i] = val;
+    }
+  }
+  return res;
+}
+
+matrix<float16> * matmul_cpu_f16c_narrow(matrix<float16> * m1, matrix<float16> * m2) {
+  return matmul_cpu_f16c_narrow(m1, m2, epilogue<float, float16>());
+}
+
+matrix<float> * matmul_cpu_bf16(matrix<bfloat16> * m1, matrix<bfloat16> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  for (int i = 0; i < m1->rows; i++) {
+    const bfloat16 * m1_row = m1->_elements->at(i).data();
+    for (int j = 0; j < m2->cols; j++) {
+      const bfloat16 * m2_col = m2->_elements_col_maj->at(j).data();
+      const auto val = ep.apply(dot_bf16(m1_row, m2_col, m1->cols), i, j);
+      res->_elements->at(i)[j] = val;
+      res->_elements_col_maj->at(j)[i] = val;
+    }
+  }
+  return res;
+}
+
+matrix<float> * matmul_cpu_bf16(matrix<bfloat16> * m1, matrix<bfloat16> * m2) {
+  return matmul_cpu_bf16(m1, m2, epilogue<float>());
+}
+
+matrix<bfloat16> * matmul_cpu_bf16_narrow(matrix<bfloat16> * m1, matrix<bfloat16> * m2, const epilogue<float, bfloat16> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<bfloat16>(m1->rows, m2->cols);
+  for (int i = 0; i < m1->rows; i++) {
+    const bfloat16 * m1_row = m1->_elements->at(i).data();
+    for (int j = 0; j < m2->cols; j++) {
+      const bfloat16 * m2_col = m2->_elements_col_maj->at(j).data();
+      const auto val = ep.store(dot_bf16(m1_row, m2_col, m1->cols), i, j);
+      res->_elements->at(i)[j] = val;
+      res->_elements_col_maj->at(j)[i] = val;
+    }
+  }
+  return res;
+}
+
+matrix<bfloat16> * matmul_cpu_bf16_narrow(matrix<bfloat16> * m1, matrix<bfloat16> * m2) {
+  return matmul_cpu_bf16_narrow(m1, m2, epilogue<float, bfloat16>());
+}
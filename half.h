@@ -0,0 +1,99 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstdint>
+#include <cstring>
+
+// Reduced precision storage types.  Both are 16 bits wide so a matrix of
+// them takes half the memory (and half the bandwidth) of a matrix<float>.
+// They are storage only: arithmetic happens by converting to float, which is
+// what the SIMD kernels do on load before accumulating in fp32.
+
+// IEEE 754 binary16: 1 sign bit, 5 exponent bits, 10 mantissa bits.
+// Converts with round-to-nearest-even, the same as _mm256_cvtps_ph.
+struct float16 {
+  uint16_t bits;
+
+  float16() : bits(0) {}
+  float16(float f) : bits(from_float(f)) {}
+  operator float() const { return to_float(bits); }
+
+  static uint16_t from_float(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t fexp = (x >> 23) & 0xff;
+    uint32_t mant = x & 0x7fffff;
+
+    // Infinity and NaN (keep NaN quiet)
+    if (fexp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    int exp = (int) fexp - 127 + 15;
+    if (exp >= 0x1f) return sign | 0x7c00;
+
+    // Result is subnormal (or rounds to zero)
+    if (exp <= 0) {
+      if (exp < -10) return sign;
+      mant |= 0x800000;
+      uint32_t shift = 14 - exp;
+      uint32_t h = mant >> shift;
+      uint32_t rem = mant & ((1u << shift) - 1);
+      uint32_t halfway = 1u << (shift - 1);
+      if (rem > halfway || (rem == halfway && (h & 1))) h++;
+      return sign | h;
+    }
+
+    // A carry out of the mantissa correctly bumps the exponent
+    uint32_t h = sign | (exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return h;
+  }
+
+  static float to_float(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+      // Subnormal halves are normal floats, let the FPU scale them by 2^-24
+      float f = mant * 5.9604644775390625e-08f;
+      return sign ? -f : f;
+    } else if (exp == 0x1f) {
+      x = sign | 0x7f800000 | (mant << 13);
+    } else {
+      x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+  }
+};
+
+// bfloat16: the top half of an fp32.  Same range as float with an 8 bit
+// mantissa, so widening is just a 16 bit shift.
+struct bfloat16 {
+  uint16_t bits;
+
+  bfloat16() : bits(0) {}
+  bfloat16(float f) : bits(from_float(f)) {}
+  operator float() const { return to_float(bits); }
+
+  static uint16_t from_float(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000) return (x >> 16) | 0x40;
+    // Round to nearest even
+    x += 0x7fff + ((x >> 16) & 1);
+    return x >> 16;
+  }
+
+  static float to_float(uint16_t h) {
+    uint32_t x = (uint32_t) h << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+  }
+};
+
+#endif //HALF_H
@@ -4,11 +4,22 @@
 #include <chrono>
 #include <memory>
 #include "matrix.h"
+#include "multiply.h"
+#include "expr.h"
+#include "packed.h"
+#include "async.h"
+#include "triangular.h"
+#include "distributed.h"
+#include <future>
+#include <thread>
+#include <sys/resource.h>
 #include "ssecheck.h"
 
 int en_sse = 0;
 int en_avx = 0;
 int en_avx2 = 0;
+int en_f16c = 0;
+int en_avx512bf16 = 0;
 
 void test_matrix() {  
   matrix<unsigned int> m1(10, 10);
@@ -58,6 +69,995 @@ void test_matrix() {
   std::cout << "Matrix test successful" << std::endl;
 }
 
+void test_half_precision() {
+  // Round trips through the 16 bit types
+  assert(float(float16(1.5f)) == 1.5f);
+  assert(float(float16(-2.0f)) == -2.0f);
+  assert(float(float16(65504.0f)) == 65504.0f);
+  assert(float(float16(1e-7f)) > 0.0f);
+  assert(float(bfloat16(3.0f)) == 3.0f);
+  assert(float(bfloat16(-0.5f)) == -0.5f);
+
+  // Compare the half width kernels against a float reference.
+  // 37 is deliberately not a multiple of the SIMD widths so the tails run.
+  const int n = 37;
+  matrix<float> a(n, n), b(n, n);
+  matrix<float16> a16(n, n), b16(n, n);
+  matrix<bfloat16> abf(n, n), bbf(n, n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      float va = ((i * 7 + j * 3) % 11) * 0.25f;
+      float vb = ((i * 5 + j) % 13) * 0.5f;
+      a.set(i, j, va);
+      b.set(i, j, vb);
+      a16.set(i, j, va);
+      b16.set(i, j, vb);
+      abf.set(i, j, va);
+      bbf.set(i, j, vb);
+    }
+  }
+
+  auto c16 = matmul_cpu_f16c(&a16, &b16);
+  auto c16n = matmul_cpu_f16c_narrow(&a16, &b16);
+  auto cbf = matmul_cpu_bf16(&abf, &bbf);
+  auto cbfn = matmul_cpu_bf16_narrow(&abf, &bbf);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      float expected = 0;
+      for (int k = 0; k < n; k++) expected += a.get(i, k) * b.get(k, j);
+      // The inputs are exact in both formats, so fp32 output is exact too
+      assert(std::fabs(c16->get(i, j) - expected) < 1e-3f);
+      assert(std::fabs(cbf->get(i, j) - expected) < 1e-3f);
+      // Narrow outputs carry 11 and 8 significant bits respectively
+      assert(std::fabs(float(c16n->get(i, j)) - expected) <= expected / 1024);
+      assert(std::fabs(float(cbfn->get(i, j)) - expected) <= expected / 128);
+    }
+  }
+  delete c16n;
+  delete cbfn;
+
+  // Converting stores: the epilogue runs on the fp32 accumulator and rounds once
+  std::vector<float> col_bias(n);
+  for (int j = 0; j < n; j++) col_bias[j] = j * 0.25f - 4;
+  epilogue<float, float16> ep16;
+  ep16.alpha = 0.5f;
+  ep16.col_bias = &col_bias;
+  ep16.act = activation::relu;
+  epilogue<float, bfloat16> epbf(ep16);
+  c16n = matmul_cpu_f16c_narrow(&a16, &b16, ep16);
+  cbfn = matmul_cpu_bf16_narrow(&abf, &bbf, epbf);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      const float expected = ep16.apply(c16->get(i, j), i, j);
+      assert(float(c16n->get(i, j)) == float(float16(expected)));
+      assert(float(cbfn->get(i, j)) == float(bfloat16(ep16.apply(cbf->get(i, j), i, j))));
+    }
+  }
+  // Results keep their column major copy too, so they can be used as operands
+  auto c16_sq = matmul(&a, c16);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      float expected = 0;
+      for (int k = 0; k < n; k++) expected += a.get(i, k) * c16->get(k, j);
+      assert(std::fabs(c16_sq->get(i, j) - expected) <= 1e-5f * expected);
+    }
+  }
+  delete c16_sq;
+  delete c16;
+  delete c16n;
+  delete cbf;
+  delete cbfn;
+  std::cout << "Half precision test successful" << std::endl;
+}
+
+// Fill m with a deterministic pattern where roughly one in every
+// `one_in` elements is nonzero
+template <class T>
+void fill_sparse(matrix<T> * m, unsigned int one_in, unsigned int seed) {
+  for (unsigned int i = 0; i < m->rows; i++) {
+    for (unsigned int j = 0; j < m->cols; j++) {
+      unsigned int h = (i * 2654435761u) ^ (j * 40503u) ^ seed;
+      h ^= h >> 13;
+      m->set(i, j, (h % one_in == 0) ? T(h % 7 + 1) : T(0));
+    }
+  }
+}
+
+// Reference product computed straight from get(), finished by ep
+template <class T>
+void check_product(matrix<T> * m1, matrix<T> * m2, matrix<T> * res, const epilogue<T> & ep) {
+  assert(res->rows == m1->rows && res->cols == m2->cols);
+  for (unsigned int i = 0; i < m1->rows; i++) {
+    for (unsigned int j = 0; j < m2->cols; j++) {
+      T expected = 0;
+      for (unsigned int k = 0; k < m1->cols; k++) expected += m1->get(i, k) * m2->get(k, j);
+      expected = ep.apply(expected, i, j);
+      // Allow for rounding in the epilogue (GELU) on floating point types
+      double diff = std::fabs(double(res->get(i, j)) - double(expected));
+      assert(diff <= 1e-5 * std::max(1.0, std::fabs(double(expected))));
+    }
+  }
+}
+
+template <class T>
+void check_product(matrix<T> * m1, matrix<T> * m2, matrix<T> * res) {
+  check_product(m1, m2, res, epilogue<T>());
+}
+
+void test_sparse() {
+  // Odd sizes so the edge blocks and SIMD tails are exercised
+  matrix<float> a(53, 41), b(41, 45);
+  fill_sparse(&a, 20, 1);
+  fill_sparse(&b, 1, 2);
+  assert(density(&a) < sparse_density_threshold);
+
+  csr_matrix<float> a_csr(&a);
+  bsr_matrix<float> a_bsr(&a);
+  assert(a_csr.nnz() > 0);
+
+  auto c = matmul_csr(&a_csr, &b);
+  check_product(&a, &b, c);
+  delete c;
+  c = matmul_bsr(&a_bsr, &b);
+  check_product(&a, &b, c);
+  delete c;
+
+  // The generic template kernels
+  matrix<uint32_t> a32(30, 17), b32(17, 11);
+  fill_sparse(&a32, 4, 3);
+  fill_sparse(&b32, 1, 4);
+  csr_matrix<uint32_t> a32_csr(&a32);
+  bsr_matrix<uint32_t> a32_bsr(&a32, 4);
+  auto c32 = matmul_csr(&a32_csr, &b32);
+  check_product(&a32, &b32, c32);
+  delete c32;
+  c32 = matmul_bsr(&a32_bsr, &b32);
+  check_product(&a32, &b32, c32);
+  delete c32;
+
+  // matmul() picks sparse or dense on its own, either way the answer matches
+  c = matmul(&a, &b);
+  check_product(&a, &b, c);
+  delete c;
+  matrix<float> dense(45, 53);
+  fill_sparse(&dense, 1, 5);
+  c = matmul(&dense, &a);
+  check_product(&dense, &a, c);
+  delete c;
+  std::cout << "Sparse test successful" << std::endl;
+}
+
+void test_skinny() {
+  // Matrix-vector, tall-skinny with eight or fewer and more than eight
+  // columns, and short-wide, with row counts that leave partial groups
+  const unsigned int shapes[][3] = {
+    { 37, 29, 1 }, { 38, 29, 5 }, { 39, 33, 13 }, { 3, 29, 45 }, { 16, 20, 17 }
+  };
+  for (auto & shape : shapes) {
+    matrix<float> a(shape[0], shape[1]), b(shape[1], shape[2]);
+    fill_sparse(&a, 1, 6);
+    fill_sparse(&b, 1, 7);
+    matrix<uint32_t> a32(shape[0], shape[1]), b32(shape[1], shape[2]);
+    fill_sparse(&a32, 1, 6);
+    fill_sparse(&b32, 1, 7);
+
+    if (shape[2] == 1) {
+      auto c = matmul_gemv(&a, &b);
+      check_product(&a, &b, c);
+      delete c;
+      auto c32 = matmul_gemv(&a32, &b32);
+      check_product(&a32, &b32, c32);
+      delete c32;
+    }
+    if (shape[2] <= skinny_max_dim) {
+      auto c = matmul_tall_skinny(&a, &b);
+      check_product(&a, &b, c);
+      delete c;
+      auto c32 = matmul_tall_skinny(&a32, &b32);
+      check_product(&a32, &b32, c32);
+      delete c32;
+    }
+    if (shape[0] <= skinny_max_dim) {
+      auto c = matmul_short_wide(&a, &b);
+      check_product(&a, &b, c);
+      delete c;
+      auto c32 = matmul_short_wide(&a32, &b32);
+      check_product(&a32, &b32, c32);
+      delete c32;
+    }
+
+    auto c = matmul(&a, &b);
+    check_product(&a, &b, c);
+    delete c;
+  }
+  std::cout << "Skinny test successful" << std::endl;
+}
+
+void test_epilogue() {
+  matrix<float> a(21, 19), b(19, 27);
+  fill_sparse(&a, 1, 8);
+  fill_sparse(&b, 1, 9);
+  for (unsigned int i = 0; i < a.rows; i += 2) a.set(i, 0, -40);
+
+  std::vector<float> row_bias(a.rows), col_bias(b.cols);
+  for (unsigned int i = 0; i < a.rows; i++) row_bias[i] = i * 0.5f - 3;
+  for (unsigned int j = 0; j < b.cols; j++) col_bias[j] = j * 0.25f;
+
+  epilogue<float> ep;
+  ep.alpha = 0.5f;
+  ep.row_bias = &row_bias;
+  ep.col_bias = &col_bias;
+
+  const activation acts[] = { activation::none, activation::relu, activation::gelu, activation::clamp };
+  for (activation act : acts) {
+    ep.act = act;
+    ep.clamp_min = -10;
+    ep.clamp_max = 100;
+
+    matrix<float> * c;
+    c = matmul_cpu_sse(&a, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+    c = matmul_cpu_avx(&a, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+    c = matmul_cpu_avxfma(&a, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+    c = matmul_cpu_cache_block(&a, &b, 8, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+    c = matmul(&a, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+
+    csr_matrix<float> a_csr(&a);
+    c = matmul_csr(&a_csr, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+    bsr_matrix<float> a_bsr(&a);
+    c = matmul_bsr(&a_bsr, &b, ep);
+    check_product(&a, &b, c, ep);
+    delete c;
+
+    // Narrow shapes: take leading slices of a and b
+    matrix<float> b1(19, 1), b9(19, 9), a5(5, 19);
+    for (unsigned int k = 0; k < 19; k++) {
+      b1.set(k, 0, b.get(k, 0));
+      for (unsigned int j = 0; j < 9; j++) b9.set(k, j, b.get(k, j));
+      for (unsigned int i = 0; i < 5; i++) a5.set(i, k, a.get(i, k));
+    }
+    c = matmul_gemv(&a, &b1, ep);
+    check_product(&a, &b1, c, ep);
+    delete c;
+    c = matmul_tall_skinny(&a, &b9, ep);
+    check_product(&a, &b9, c, ep);
+    delete c;
+    c = matmul_short_wide(&a5, &b, ep);
+    check_product(&a5, &b, c, ep);
+    delete c;
+  }
+
+  // The generic sparse kernels, which double has no SIMD version of
+  matrix<double> ad(21, 19), bd(19, 27);
+  fill_sparse(&ad, 3, 8);
+  fill_sparse(&bd, 1, 9);
+  std::vector<double> row_bias_d(row_bias.begin(), row_bias.end());
+  epilogue<double> epd;
+  epd.alpha = 0.5;
+  epd.row_bias = &row_bias_d;
+  epd.act = activation::relu;
+  csr_matrix<double> ad_csr(&ad);
+  auto cd = matmul_csr(&ad_csr, &bd, epd);
+  check_product(&ad, &bd, cd, epd);
+  delete cd;
+  bsr_matrix<double> ad_bsr(&ad);
+  cd = matmul_bsr(&ad_bsr, &bd, epd);
+  check_product(&ad, &bd, cd, epd);
+  delete cd;
+
+  // Integer kernels get scaling and clamping too
+  matrix<uint32_t> a32(9, 13), b32(13, 6);
+  fill_sparse(&a32, 1, 10);
+  fill_sparse(&b32, 1, 11);
+  epilogue<uint32_t> ep32;
+  ep32.alpha = 3;
+  ep32.act = activation::clamp;
+  ep32.clamp_min = 100;
+  ep32.clamp_max = 400;
+  auto c32 = matmul_cpu_sse(&a32, &b32, ep32);
+  check_product(&a32, &b32, c32, ep32);
+  delete c32;
+  std::cout << "Epilogue test successful" << std::endl;
+}
+
+// Reference product of two matrices, via get() and set()
+template <class T>
+matrix<T> * reference_product(matrix<T> * m1, matrix<T> * m2) {
+  auto res = new matrix<T>(m1->rows, m2->cols);
+  for (unsigned int i = 0; i < m1->rows; i++) {
+    for (unsigned int j = 0; j < m2->cols; j++) {
+      T acc = 0;
+      for (unsigned int k = 0; k < m1->cols; k++) acc += m1->get(i, k) * m2->get(k, j);
+      res->set(i, j, acc);
+    }
+  }
+  return res;
+}
+
+template <class T>
+void check_equal(matrix<T> * expected, matrix<T> * actual) {
+  assert(expected->rows == actual->rows && expected->cols == actual->cols);
+  for (unsigned int i = 0; i < expected->rows; i++) {
+    for (unsigned int j = 0; j < expected->cols; j++) assert(expected->get(i, j) == actual->get(i, j));
+  }
+}
+
+void test_expressions() {
+  // The textbook chain: ((A1 A2) A3) costs 7500, (A1 (A2 A3)) costs 75000
+  double cost;
+  auto split = optimal_chain_order({ 10, 100, 5, 50 }, &cost);
+  assert(cost == 7500);
+  assert(split[0][2] == 1);
+
+  matrix<float> a(6, 7), b(7, 4), c(4, 9), x(9, 1), d(6, 4), s(6, 6);
+  fill_sparse(&a, 1, 12);
+  fill_sparse(&b, 1, 13);
+  fill_sparse(&c, 1, 14);
+  fill_sparse(&x, 1, 15);
+  fill_sparse(&d, 1, 16);
+  fill_sparse(&s, 1, 17);
+
+  auto ab = reference_product(&a, &b);
+  auto abc = reference_product(ab, &c);
+  auto abcx = reference_product(abc, &x);
+
+  // A chain of four with the result vector allocated by evaluate
+  auto res = evaluate(a * b * c * x);
+  check_equal(abcx, res);
+  delete res;
+
+  // A * B + D materialized into an existing matrix
+  matrix<float> sum(6, 4);
+  evaluate(a * b + d, &sum);
+  for (unsigned int i = 0; i < 6; i++) {
+    for (unsigned int j = 0; j < 4; j++) assert(sum.get(i, j) == ab->get(i, j) + d.get(i, j));
+  }
+
+  // Transposes fold into the leaves: (A B)' = B' A'
+  res = evaluate(transpose(a * b));
+  for (unsigned int i = 0; i < 4; i++) {
+    for (unsigned int j = 0; j < 6; j++) assert(res->get(i, j) == ab->get(j, i));
+  }
+  delete res;
+  res = evaluate(transpose(b) * transpose(a) + transpose(d));
+  for (unsigned int i = 0; i < 4; i++) {
+    for (unsigned int j = 0; j < 6; j++) assert(res->get(i, j) == ab->get(j, i) + d.get(j, i));
+  }
+  delete res;
+
+  // A sum nested inside a product
+  res = evaluate((a * b + d) * c);
+  auto expected = reference_product(&sum, &c);
+  check_equal(expected, res);
+  delete res;
+  delete expected;
+
+  // The destination is also an operand
+  auto ss = reference_product(&s, &s);
+  evaluate(s * s, &s);
+  check_equal(ss, &s);
+  // ...and the column major copy was kept up to date
+  auto sa = reference_product(&s, &a);
+  res = evaluate(transpose(transpose(s)) * a);
+  check_equal(sa, res);
+  delete res;
+
+  // Large enough for the packed kernel, both operands transposed, then
+  // added into the partial sum
+  matrix<float> p(33, 40), q(45, 33);
+  fill_sparse(&p, 1, 18);
+  fill_sparse(&q, 1, 19);
+  auto qp = reference_product(&q, &p);
+  res = evaluate(transpose(p) * transpose(q) + transpose(p) * transpose(q));
+  for (unsigned int i = 0; i < 40; i++) {
+    for (unsigned int j = 0; j < 45; j++) assert(res->get(i, j) == 2 * qp->get(j, i));
+  }
+  delete res;
+  delete qp;
+
+  // Products of a matrix with its own transpose go to the SYRK kernel
+  res = evaluate(p * transpose(p) + transpose(q) * q);
+  for (unsigned int i = 0; i < 33; i++) {
+    for (unsigned int j = 0; j < 33; j++) {
+      float expected = 0;
+      for (unsigned int k = 0; k < 40; k++) expected += p.get(i, k) * p.get(j, k);
+      for (unsigned int k = 0; k < 45; k++) expected += q.get(k, i) * q.get(k, j);
+      assert(res->get(i, j) == expected);
+    }
+  }
+  delete res;
+
+  delete ss;
+  delete sa;
+  delete ab;
+  delete abc;
+  delete abcx;
+  std::cout << "Expression test successful" << std::endl;
+}
+
+void test_packed() {
+  matrix<float> w(37, 45);
+  fill_sparse(&w, 1, 18);
+  matrix<uint32_t> w32(37, 45);
+  fill_sparse(&w32, 1, 18);
+
+  // Pack once, for every layout the CPU supports
+  const pack_isa isas[] = { pack_isa::generic, pack_isa::avx2 };
+  for (pack_isa isa : isas) {
+    if (!pack_isa_supported(isa)) continue;
+    packed_handle<float> packed_w = pack(&w, isa);
+    assert(packed_w->rows == 37 && packed_w->cols == 45 && packed_w->isa == isa);
+
+    // ...then multiply many different left hand sides against it
+    const unsigned int heights[] = { 1, 3, 4, 9, 64 };
+    for (unsigned int h : heights) {
+      matrix<float> a(h, 37);
+      fill_sparse(&a, 1, h);
+      auto c = matmul_packed(&a, *packed_w);
+      check_product(&a, &w, c);
+      delete c;
+
+      epilogue<float> ep;
+      ep.alpha = 2;
+      ep.act = activation::relu;
+      c = matmul_packed(&a, *packed_w, ep);
+      check_product(&a, &w, c, ep);
+      delete c;
+    }
+
+    // The same handle used from several threads at once
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < 4; t++) {
+      threads.emplace_back([packed_w, &w, t]() {
+        matrix<float> a(10 + t, 37);
+        fill_sparse(&a, 1, 100 + t);
+        auto c = matmul_packed(&a, *packed_w);
+        check_product(&a, &w, c);
+        delete c;
+      });
+    }
+    for (auto & t : threads) t.join();
+  }
+
+  // The generic kernel for other types
+  auto packed_w32 = pack(&w32);
+  matrix<uint32_t> a32(7, 37);
+  fill_sparse(&a32, 1, 19);
+  auto c32 = matmul_packed(&a32, *packed_w32);
+  check_product(&a32, &w32, c32);
+  delete c32;
+  std::cout << "Packed test successful" << std::endl;
+}
+
+void test_placement() {
+  // Topology parsing and the single node fallback
+  const std::vector<int> cpus = parse_cpulist("0-3,8,10-11\n");
+  assert((cpus == std::vector<int>{ 0, 1, 2, 3, 8, 10, 11 }));
+  const auto no_nodes = read_numa_topology("/nonexistent");
+  assert(no_nodes.size() == 1 && no_nodes[0].empty());
+  assert(numa_nodes().size() >= 1);
+  assert(node_of_row(0, 10, 2) == 0 && node_of_row(4, 10, 2) == 0 && node_of_row(5, 10, 2) == 1);
+  // node_of_row agrees with the slices first touch hands out
+  const auto slices = balanced_partition(10, [](unsigned int i) { return (size_t) i; }, 3);
+  for (unsigned int n = 0; n < 3; n++) {
+    for (unsigned int r = slices[n]; r < slices[n + 1]; r++) assert(node_of_row(r, 10, 3) == n);
+  }
+
+  const alloc_policy policies[] = { alloc_policy(), alloc_policy(true, false),
+                                    alloc_policy(false, true), alloc_policy(true, true) };
+  const auto saved_nodes = numa_nodes();
+  for (int simulated = 0; simulated < 2; simulated++) {
+    // Pretend every CPU this process may use is on each of two nodes, so the
+    // pinning and first touch paths run even on a single node machine
+    if (simulated) {
+      std::vector<int> allowed;
+      cpu_set_t set;
+      if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) if (CPU_ISSET(c, &set)) allowed.push_back(c);
+      }
+      set_numa_nodes({ allowed, allowed });
+    }
+
+    for (const alloc_policy & policy : policies) {
+      // Results allocated by the kernels follow the default policy
+      set_default_alloc_policy(policy);
+      matrix<float> a(70, 90, policy);
+      matrix<float> b(90, 50, policy);
+      fill_sparse(&a, 1, 20);
+      fill_sparse(&b, 1, 21);
+      assert((a.backing() == page_kind::heap) == !policy.uses_arena());
+
+      auto c = matmul(&a, &b);
+      assert((c->backing() == page_kind::heap) == !policy.uses_arena());
+      check_product(&a, &b, c);
+      delete c;
+
+      // transpose() keeps the storage it was placed in
+      a.transpose();
+      assert((a.backing() == page_kind::heap) == !policy.uses_arena());
+      assert(a.rows == 90 && a.cols == 70);
+    }
+
+    // Workers of a row partition run (pinned, if there are several nodes) and see their ranges
+    std::vector<unsigned int> seen(8, 0);
+    parallel_ranges(std::vector<unsigned int>{ 0, 3, 5, 8 }, [&](unsigned int begin, unsigned int end) {
+      for (unsigned int i = begin; i < end; i++) seen[i]++;
+    }, true);
+    for (unsigned int v : seen) assert(v == 1);
+  }
+  set_numa_nodes(saved_nodes);
+  set_default_alloc_policy(alloc_policy());
+
+  // Large enough for huge pages; which kind depends on how the system is set up
+  matrix<float> big(1024, 1024, alloc_policy(true, true));
+  const char * kinds[] = { "heap", "small pages", "transparent huge pages", "explicit huge pages" };
+  std::cout << "Placement test successful (" << numa_nodes().size() << " NUMA node(s), 4MB matrix on "
+            << kinds[(int) big.backing()] << ")" << std::endl;
+}
+
+// Copy of tri with everything outside its uplo triangle zeroed, and that
+// part of tri itself filled with junk the kernels must not read
+template <class T>
+matrix<T> * mask_triangle(matrix<T> * tri, triangle uplo) {
+  auto masked = new matrix<T>(tri->rows, tri->cols);
+  for (unsigned int i = 0; i < tri->rows; i++) {
+    for (unsigned int j = 0; j < tri->cols; j++) {
+      bool inside = uplo == triangle::lower ? j <= i : j >= i;
+      masked->set(i, j, inside ? tri->get(i, j) : T(0));
+      if (!inside) tri->set(i, j, T(1000));
+    }
+  }
+  return masked;
+}
+
+template <class T>
+void check_triangular(unsigned int n, unsigned int depth, unsigned int seed) {
+  matrix<T> a(n, depth);
+  fill_sparse(&a, 1, seed);
+  matrix<T> at(depth, n);
+  for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int k = 0; k < depth; k++) at.set(k, i, a.get(i, k));
+  }
+
+  // a * a' and a' * a, plain and with biases that differ across the diagonal
+  std::vector<T> row_bias(std::max(n, depth)), col_bias(std::max(n, depth));
+  for (unsigned int i = 0; i < row_bias.size(); i++) {
+    row_bias[i] = T(i % 3);
+    col_bias[i] = T(i % 5);
+  }
+  epilogue<T> ep;
+  ep.row_bias = &row_bias;
+  ep.col_bias = &col_bias;
+  auto c = matmul_syrk(&a);
+  check_product(&a, &at, c);
+  delete c;
+  c = matmul_syrk(&a, false, ep);
+  check_product(&a, &at, c, ep);
+  delete c;
+  c = matmul_syrk(&a, true, ep);
+  check_product(&at, &a, c, ep);
+  delete c;
+
+  // Triangular operand on either side, in either triangle
+  const triangle uplos[] = { triangle::lower, triangle::upper };
+  for (triangle uplo : uplos) {
+    matrix<T> tri(depth, depth);
+    fill_sparse(&tri, 1, seed + 1);
+    auto masked = mask_triangle(&tri, uplo);
+    matrix<T> other(depth, n);
+    fill_sparse(&other, 1, seed + 2);
+    c = matmul_trmm(&tri, &other, tri_side::left, uplo, ep);
+    check_product(masked, &other, c, ep);
+    delete c;
+    c = matmul_trmm(&a, &tri, tri_side::right, uplo);
+    check_product(&a, masked, c);
+    delete c;
+    delete masked;
+  }
+}
+
+void test_triangular() {
+  // Sizes around the 4 x 4 tiles and the 8 wide vectors
+  const unsigned int sizes[][2] = { { 1, 1 }, { 3, 9 }, { 7, 45 }, { 37, 16 }, { 40, 33 } };
+  for (auto & size : sizes) {
+    check_triangular<float>(size[0], size[1], size[0] + size[1]);
+    check_triangular<uint32_t>(size[0], size[1], size[0] * size[1]);
+  }
+
+  // Expressions multiplying a matrix by its own transpose mirror one triangle
+  matrix<float> a(23, 31);
+  fill_sparse(&a, 1, 29);
+  auto gram = evaluate(a * transpose(a));
+  auto syrk = matmul_syrk(&a);
+  check_equal(syrk, gram);
+  delete gram;
+  delete syrk;
+  std::cout << "Triangular test successful" << std::endl;
+}
+
+void large_matrix_test_triangular() {
+    int large_matrix_size = 768;
+    std::cout << "Starting Triangular Test. Size: " << large_matrix_size << " x " << large_matrix_size << std::endl;
+    matrix<float> a(large_matrix_size, large_matrix_size);
+    matrix<float> at(large_matrix_size, large_matrix_size);
+    fill_sparse(&a, 1, 30);
+    fill_sparse(&at, 1, 30);
+    at.transpose();
+
+    auto before = std::chrono::high_resolution_clock::now();
+    delete matmul_cpu_avxfma(&a, &at);
+    auto after = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "AVX FMA, a * a': " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    delete matmul_syrk(&a);
+    after = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "SYRK, a * a': " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    delete matmul_trmm(&a, &at, tri_side::left, triangle::lower);
+    after = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "TRMM, lower(a) * b: " << duration.count() << " milliseconds" << std::endl;
+}
+
+void test_distributed() {
+  assert(block_cyclic_extent(37, 8, 0, 2) == 21 && block_cyclic_extent(37, 8, 1, 2) == 16);
+  assert(block_cyclic_global(9, 8, 1, 2) == 25);
+  unsigned int grid_rows, grid_cols;
+  summa_grid(6, &grid_rows, &grid_cols);
+  assert(grid_rows == 2 && grid_cols == 3);
+
+  matrix<float> a(37, 45);
+  matrix<float> b(45, 29);
+  fill_sparse(&a, 1, 31);
+  fill_sparse(&b, 1, 32);
+  std::vector<float> bias(37), col_bias(29);
+  for (unsigned int i = 0; i < 37; i++) bias[i] = i % 4 - 1.5f;
+  for (unsigned int j = 0; j < 29; j++) col_bias[j] = j % 5 - 2.0f;
+  epilogue<float> ep;
+  ep.alpha = 0.5f;
+  ep.row_bias = &bias;
+  ep.col_bias = &col_bias;
+  ep.act = activation::relu;
+
+  // Every transport, on grids of one to four workers, with edge blocks
+  const transport_kind kinds[] = { transport_kind::shared_memory, transport_kind::unix_socket, transport_kind::tcp_socket };
+  for (transport_kind kind : kinds) {
+    for (unsigned int workers = 1; workers <= 4; workers++) {
+      summa_config config(workers, kind);
+      config.block_size = 8;
+      auto c = matmul_summa(&a, &b, config);
+      check_product(&a, &b, c);
+      delete c;
+      c = matmul_summa(&a, &b, config, ep);
+      check_product(&a, &b, c, ep);
+      delete c;
+    }
+  }
+
+  // A 1 x 3 grid with blocks large enough that panels take the packed kernel,
+  // and an integer type
+  matrix<float> big_a(70, 90), big_b(90, 80);
+  fill_sparse(&big_a, 1, 33);
+  fill_sparse(&big_b, 1, 34);
+  summa_config config(3, transport_kind::unix_socket);
+  config.grid_rows = 1;
+  config.grid_cols = 3;
+  config.block_size = 32;
+  auto c = matmul_summa(&big_a, &big_b, config);
+  check_product(&big_a, &big_b, c);
+  delete c;
+
+  matrix<uint32_t> a32(20, 19), b32(19, 23);
+  fill_sparse(&a32, 1, 35);
+  fill_sparse(&b32, 1, 36);
+  auto c32 = matmul_summa(&a32, &b32, summa_config(2, transport_kind::shared_memory));
+  check_product(&a32, &b32, c32);
+  delete c32;
+
+  // A peer that exits without sending fails the receive instead of hanging it
+  for (transport_kind kind : kinds) {
+    auto t = make_transport(kind, 2);
+    std::cout << std::flush;
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      t->attach(1);
+      _exit(3);
+    }
+    t->attach(0);
+    int status = 0;
+    bool exited = false;
+    t->watch([&]() {
+      exited = exited || waitpid(pid, &status, WNOHANG) == pid;
+      return !exited;
+    });
+    float buf[4];
+    assert(!t->recv(1, buf, sizeof(buf)));
+    if (!exited) waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+  }
+
+  // Running out of file descriptors fails the setup, and the multiply
+  // returns null before forking
+  rlimit files;
+  getrlimit(RLIMIT_NOFILE, &files);
+  rlimit lowered = files;
+  lowered.rlim_cur = std::min<rlim_t>(files.rlim_cur, 32);
+  setrlimit(RLIMIT_NOFILE, &lowered);
+  assert(make_transport(transport_kind::unix_socket, 16) == nullptr);
+  assert(make_transport(transport_kind::tcp_socket, 16) == nullptr);
+  assert(matmul_summa(&a32, &b32, summa_config(15, transport_kind::unix_socket)) == nullptr);
+  setrlimit(RLIMIT_NOFILE, &files);
+  std::cout << "Distributed test successful" << std::endl;
+}
+
+// Time a fixed size multiply as workers are added, for each transport.
+// Efficiency is the one worker time over (workers x the time with that many).
+// Workers stop at the core count; past it they would only share cores.
+void distributed_scaling_test() {
+    int large_matrix_size = 768;
+    unsigned int max_workers = hardware_threads();
+    std::cout << "Starting Distributed Scaling Test. Size: " << large_matrix_size << " x " << large_matrix_size
+              << ", cores: " << hardware_threads() << std::endl;
+    if (max_workers == 1) std::cout << "Only one core, so only one worker is timed" << std::endl;
+    matrix<float> a(large_matrix_size, large_matrix_size);
+    matrix<float> b(large_matrix_size, large_matrix_size);
+    fill_sparse(&a, 1, 37);
+    fill_sparse(&b, 1, 38);
+
+    const transport_kind kinds[] = { transport_kind::shared_memory, transport_kind::unix_socket, transport_kind::tcp_socket };
+    for (transport_kind kind : kinds) {
+      double base = 0;
+      for (unsigned int workers = 1; workers <= max_workers; workers *= 2) {
+        summa_config config(workers, kind);
+        auto before = std::chrono::high_resolution_clock::now();
+        delete matmul_summa(&a, &b, config);
+        auto after = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(after - before).count();
+        if (workers == 1) base = ms;
+        std::cout << transport_name(kind) << ", " << workers << " worker(s): " << (long) ms
+                  << " milliseconds, efficiency " << (int) (100 * base / (workers * ms)) << "%" << std::endl;
+      }
+    }
+}
+
+#if defined(__cpp_impl_coroutine)
+// Minimal coroutine type that runs to completion on its own
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+detached_task await_product(matmul_future<float> product, std::promise<matrix<float> *> * out) {
+  out->set_value(co_await product);
+}
+#endif
+
+void test_async() {
+  // Wide enough for several pipeline blocks of every packed layout, the
+  // last one partial, and dense
+  matrix<float> a(45, 37);
+  matrix<float> b(37, 150);
+  fill_sparse(&a, 1, 22);
+  fill_sparse(&b, 1, 23);
+
+  auto c = matmul_async(&a, &b).get();
+  check_product(&a, &b, c);
+  delete c;
+
+  std::vector<float> bias(150);
+  for (unsigned int j = 0; j < 150; j++) bias[j] = j % 5 - 2.0f;
+  epilogue<float> ep;
+  ep.col_bias = &bias;
+  ep.act = activation::relu;
+  c = matmul_async(&a, &b, ep).get();
+  check_product(&a, &b, c, ep);
+  delete c;
+
+  // Many multiplies in flight on a small private executor, harvested afterwards
+  {
+    executor pool(2);
+    auto packed_b = pack(&b);
+    std::vector<matmul_future<float>> pending;
+    for (unsigned int n = 0; n < 8; n++) {
+      pending.push_back(n % 2 == 0 ? matmul_async(&a, &b, pool) : matmul_async(&a, packed_b, pool));
+    }
+    matrix<float> narrow(5, 37);
+    fill_sparse(&narrow, 1, 24);
+    auto narrow_product = matmul_async(&narrow, &b, pool);
+    for (auto & f : pending) {
+      c = f.get();
+      check_product(&a, &b, c);
+      delete c;
+    }
+    c = narrow_product.get();
+    assert(narrow_product.ready());
+    check_product(&narrow, &b, c);
+    delete c;
+  }
+
+  matrix<uint32_t> a32(20, 37);
+  matrix<uint32_t> b32(37, 30);
+  fill_sparse(&a32, 1, 25);
+  fill_sparse(&b32, 1, 26);
+  auto c32 = matmul_async(&a32, &b32).get();
+  check_product(&a32, &b32, c32);
+  delete c32;
+
+#if defined(__cpp_impl_coroutine)
+  std::promise<matrix<float> *> awaited;
+  await_product(matmul_async(&a, &b), &awaited);
+  c = awaited.get_future().get();
+  check_product(&a, &b, c);
+  delete c;
+#endif
+  std::cout << "Async test successful" << std::endl;
+}
+
+void large_matrix_test_async() {
+    int large_matrix_size = 512;
+    int num_requests = 16;
+    std::cout << "Starting Async Test. Size: " << large_matrix_size << " x " << large_matrix_size
+              << ", requests: " << num_requests << std::endl;
+    matrix<float> a(large_matrix_size, large_matrix_size);
+    matrix<float> b(large_matrix_size, large_matrix_size);
+    fill_sparse(&a, 1, 27);
+    fill_sparse(&b, 1, 28);
+
+    // The same packed kernel, packing b for every request as the pipeline
+    // does, so only the scheduling differs
+    auto before = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < num_requests; r++) delete matmul_packed(&a, *pack(&b));
+    auto after = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "Synchronous matmul_packed: " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    std::vector<matmul_future<float>> pending;
+    for (int r = 0; r < num_requests; r++) pending.push_back(matmul_async(&a, &b));
+    for (auto & f : pending) delete f.get();
+    after = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "Pipelined matmul_async: " << duration.count() << " milliseconds" << std::endl;
+}
+
+void large_matrix_test_placement() {
+    int large_matrix_size = 2000;
+    int num_trials = 5;
+    std::cout << "Starting Placement Test. Size: " << large_matrix_size << " x " << large_matrix_size
+              << ", trials: " << num_trials << std::endl;
+
+    const alloc_policy policies[] = { alloc_policy(), alloc_policy(true, true) };
+    const char * names[] = { "Heap rows: ", "Huge pages, first touch: " };
+    for (int p = 0; p < 2; p++) {
+      set_default_alloc_policy(policies[p]);
+      matrix<float> a(large_matrix_size, large_matrix_size);
+      matrix<float> b(large_matrix_size, 16);
+      auto before = std::chrono::high_resolution_clock::now();
+      for (int t = 0; t < num_trials; t++) delete matmul(&a, &b);
+      auto after = std::chrono::high_resolution_clock::now();
+      auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+      std::cout << names[p] << duration.count() << " milliseconds" << std::endl;
+    }
+    set_default_alloc_policy(alloc_policy());
+}
+
+void large_matrix_test_packed() {
+    int large_matrix_size = 1000;
+    int batch = 16;
+    int num_trials = 100;
+    matrix<float> w(large_matrix_size, large_matrix_size);
+    matrix<float> a(batch, large_matrix_size);
+    std::cout << "Starting Packed Operand Test. Weights: " << large_matrix_size << " x " << large_matrix_size
+              << ", batch: " << batch << ", trials: " << num_trials << std::endl;
+
+    auto before = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < num_trials; t++) delete matmul_cpu_avxfma(&a, &w);
+    auto after = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "AVX FMA: " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    auto packed_w = pack(&w);
+    after = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "Packing (once): " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < num_trials; t++) delete matmul_packed(&a, *packed_w);
+    after = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "Pre-packed: " << duration.count() << " milliseconds" << std::endl;
+}
+
+void large_matrix_test_skinny() {
+    int large_matrix_size = 4000;
+    matrix<float> m1(large_matrix_size, large_matrix_size);
+    matrix<float> x(large_matrix_size, 1);
+    matrix<float> m2(large_matrix_size, 8);
+    std::cout << "Starting Large Skinny Matrix Test. Size: " << large_matrix_size << " x " << large_matrix_size << std::endl;
+
+    auto before = std::chrono::high_resolution_clock::now();
+    auto m3 = matmul_cpu_cache_block(&m1, &x, 64);
+    auto after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+    std::cout << "Matrix-Vector Cache Blocking: " << duration.count() << " microseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    m3 = matmul_gemv(&m1, &x);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+    std::cout << "Matrix-Vector GEMV: " << duration.count() << " microseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    m3 = matmul_cpu_cache_block(&m1, &m2, 64);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+    std::cout << "Tall-Skinny (8 Columns) Cache Blocking: " << duration.count() << " microseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    m3 = matmul_tall_skinny(&m1, &m2);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+    std::cout << "Tall-Skinny (8 Columns): " << duration.count() << " microseconds" << std::endl;
+}
+
+void large_matrix_test_sparse() {
+    int large_matrix_size = 1000;
+    matrix<float> m1(large_matrix_size, large_matrix_size);
+    matrix<float> m2(large_matrix_size, large_matrix_size);
+    fill_sparse(&m1, 20, 1);
+    std::cout << "Starting Large Sparse Matrix Test. Size: " << large_matrix_size << " x " << large_matrix_size
+              << ", density: " << density(&m1) << std::endl;
+
+    auto before = std::chrono::high_resolution_clock::now();
+    auto m3 = matmul_cpu_avxfma(&m1, &m2);
+    auto after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "Dense AVX FMA: " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    csr_matrix<float> m1_csr(&m1);
+    m3 = matmul_csr(&m1_csr, &m2);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "CSR (including conversion): " << duration.count() << " milliseconds" << std::endl;
+
+    before = std::chrono::high_resolution_clock::now();
+    bsr_matrix<float> m1_bsr(&m1);
+    m3 = matmul_bsr(&m1_bsr, &m2);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "BSR (including conversion): " << duration.count() << " milliseconds" << std::endl;
+}
+
 void large_matrix_test_float() {
     int large_matrix_size = 1000;
     matrix<float> m1(large_matrix_size, large_matrix_size);
@@ -85,6 +1085,24 @@ void large_matrix_test_float() {
     delete m3;
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
     std::cout << "AVX FMA: " << duration.count() << " milliseconds" << std::endl;
+
+    matrix<float16> m4(large_matrix_size, large_matrix_size);
+    matrix<float16> m5(large_matrix_size, large_matrix_size);
+    before = std::chrono::high_resolution_clock::now();
+    m3 = matmul_cpu_f16c(&m4, &m5);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "F16C (Half Storage): " << duration.count() << " milliseconds" << std::endl;
+
+    matrix<bfloat16> m6(large_matrix_size, large_matrix_size);
+    matrix<bfloat16> m7(large_matrix_size, large_matrix_size);
+    before = std::chrono::high_resolution_clock::now();
+    m3 = matmul_cpu_bf16(&m6, &m7);
+    after = std::chrono::high_resolution_clock::now();
+    delete m3;
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(after - before);
+    std::cout << "BF16: " << duration.count() << " milliseconds" << std::endl;
 }
 
 void large_matrix_test_fixed() {
@@ -313,15 +1331,36 @@ void floating_point_stress_test() {
 
 int main(int argc, char ** argv) {
     test_matrix();
+    test_half_precision();
+    test_sparse();
+    test_skinny();
+    test_epilogue();
+    test_expressions();
+    test_packed();
+    test_placement();
+    test_async();
+    test_triangular();
+    test_distributed();
     en_sse = sse_enabled();
     en_avx = avx_enabled();
     en_avx2 = avx2_enabled();
+    en_f16c = f16c_enabled();
+    en_avx512bf16 = avx512bf16_enabled();
     std::cout << "SSE:  " << en_sse  << std::endl;
     std::cout << "AVX:  " << en_avx << std::endl;
     std::cout << "AVX2: " << en_avx2 << std::endl;
+    std::cout << "F16C: " << en_f16c << std::endl;
+    std::cout << "AVX512 BF16: " << en_avx512bf16 << std::endl;
 
     large_matrix_test_float();
     large_matrix_test_fixed();
+    large_matrix_test_sparse();
+    large_matrix_test_skinny();
+    large_matrix_test_packed();
+    large_matrix_test_placement();
+    large_matrix_test_async();
+    large_matrix_test_triangular();
+    distributed_scaling_test();
     floating_point_stress_test();
     fixed_point_stress_test();
 }
\ No newline at end of file
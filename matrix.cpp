@@ -19,9 +19,8 @@
 // it is supported as a template specialization.
 // see: https://stackoverflow.blog/2020/07/08/improving-performance-with-simd-intrinsics-in-three-use-cases/
 // template <>
-matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2) {
-  // Change this to double
-  long long int acc;
+matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  float acc;
 
   // Make sure that matrices match 1's cols to 2's rows
   assert(m1->cols == m2->rows);
@@ -40,7 +39,7 @@ matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2) {
       __m128 m2_col_seg;
       float buf[4];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 4); k += 4) {
+      for (int k = 0; k + 4 <= m1->cols; k += 4) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm_loadu_ps(&(m1->_elements->at(i)[k]));
         m2_col_seg = _mm_loadu_ps(&(m2->_elements_col_maj->at(j)[k]));
@@ -52,17 +51,21 @@ matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2) {
       unsigned int simd_remainder = m1->cols % 4;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
       // res->set(i, j, acc);
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
 }
 
-matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2) {
+matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2) {
+  return matmul_cpu_sse(m1, m2, epilogue<float>());
+}
+
+matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2, const epilogue<double> & ep) {
 
   double acc;
 
@@ -83,7 +86,7 @@ matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2) {
       __m128d m2_col_seg;
       double buf[2];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 2); k += 2) {
+      for (int k = 0; k + 2 <= m1->cols; k += 2) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm_loadu_pd(&(m1->_elements->at(i)[k]));
         m2_col_seg = _mm_loadu_pd(&(m2->_elements_col_maj->at(j)[k]));
@@ -95,17 +98,21 @@ matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2) {
       unsigned int simd_remainder = m1->cols % 2;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
       // res->set(i, j, acc);
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
 }
 
-matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2) {
+matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2) {
+  return matmul_cpu_sse(m1, m2, epilogue<double>());
+}
+
+matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2, const epilogue<uint32_t> & ep) {
   long long int acc;
 
   // Make sure that matrices match 1's cols to 2's rows
@@ -125,7 +132,7 @@ matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2)
       __m128i m2_col_seg;
       uint32_t buf[4];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 4); k += 4) {
+      for (int k = 0; k + 4 <= m1->cols; k += 4) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm_loadu_si128((__m128i_u *)(&(m1->_elements->at(i)[k])));
         m2_col_seg = _mm_loadu_si128((__m128i_u *)(&(m2->_elements_col_maj->at(j)[k])));
@@ -137,17 +144,21 @@ matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2)
       unsigned int simd_remainder = m1->cols % 4;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
       // res->set(i, j, acc);
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
 }
 
-matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2) {
+matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2) {
+  return matmul_cpu_sse(m1, m2, epilogue<uint32_t>());
+}
+
+matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2, const epilogue<uint16_t> & ep) {
 
   long long int acc;
 
@@ -166,9 +177,9 @@ matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2)
       __m128i sum = _mm_setzero_si128();
       __m128i m1_row_seg;
       __m128i m2_col_seg;
-      float buf[4];
+      uint16_t buf[8];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 8); k += 8) {
+      for (int k = 0; k + 8 <= m1->cols; k += 8) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm_loadu_si128((__m128i_u *)(&(m1->_elements->at(i)[k])));
         m2_col_seg = _mm_loadu_si128((__m128i_u *)(&m2->_elements_col_maj->at(j)[k]));
@@ -180,19 +191,23 @@ matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2)
       unsigned int simd_remainder = m1->cols % 8;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
       // res->set(i, j, acc);
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
 }
 
+matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2) {
+  return matmul_cpu_sse(m1, m2, epilogue<uint16_t>());
+}
 
-matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2) {
-  long long int acc;
+
+matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  float acc;
 
   // Make sure that matrices match 1's cols to 2's rows
   assert(m1->cols == m2->rows);
@@ -211,7 +226,7 @@ matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2) {
       __m256 m2_col_seg;
       float buf[8];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 8); k += 8) {
+      for (int k = 0; k + 8 <= m1->cols; k += 8) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm256_loadu_ps(&(m1->_elements->at(i)[k]));
         m2_col_seg = _mm256_loadu_ps(&(m2->_elements_col_maj->at(j)[k]));
@@ -223,18 +238,22 @@ matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2) {
       unsigned int simd_remainder = m1->cols % 8;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
       // res->set(i, j, acc);
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
 }
 
-matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2) {
-  long long int acc;
+matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2) {
+  return matmul_cpu_avx(m1, m2, epilogue<float>());
+}
+
+matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  float acc;
 
   // Make sure that matrices match 1's cols to 2's rows
   assert(m1->cols == m2->rows);
@@ -253,7 +272,7 @@ matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2) {
       __m256 m2_col_seg;
       float buf[8];
       // do the dot product of m1 row with m2 column
-      for (int k = 0; k < ceil(m1->cols / 8); k += 8) {
+      for (int k = 0; k + 8 <= m1->cols; k += 8) {
         // acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
         m1_row_seg = _mm256_loadu_ps(&(m1->_elements->at(i)[k]));
         m2_col_seg = _mm256_loadu_ps(&(m2->_elements_col_maj->at(j)[k]));
@@ -265,11 +284,15 @@ matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2) {
       unsigned int simd_remainder = m1->cols % 8;
       if (simd_remainder != 0) {
         for (int k = m1->cols - simd_remainder; k < m1->cols; k++) {
-            acc += m1->_elements->at(i)[k] * m2->_elements->at(j)[k];
+            acc += m1->_elements->at(i)[k] * m2->_elements_col_maj->at(j)[k];
         }
       }
-      res->_elements->at(i)[j] = acc;
+      res->_elements->at(i)[j] = ep.apply(acc, i, j);
     }
   }
   return res;
-}
\ No newline at end of file
+}
+
+matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2) {
+  return matmul_cpu_avxfma(m1, m2, epilogue<float>());
+}
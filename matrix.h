@@ -7,6 +7,15 @@
 #include <iostream>
 #include <cmath>
 #include <x86intrin.h>
+#include "half.h"
+#include "epilogue.h"
+#include "placement.h"
+
+template <class T> class csr_matrix;
+template <class T> class bsr_matrix;
+template <class T> class packed_matrix;
+enum class triangle;
+enum class tri_side;
 
 template <class T>
 class matrix {
@@ -15,7 +24,12 @@ class matrix {
     unsigned int rows; 
     unsigned int cols;
 
-    matrix (unsigned int nRows, unsigned int nCols);
+    // Storage: rows (or columns, for the column major copy) of elements
+    typedef std::vector<T, row_allocator<T>> row_type;
+    typedef std::vector<row_type> storage_type;
+
+    // See placement.h for what the allocation policy controls
+    matrix (unsigned int nRows, unsigned int nCols, const alloc_policy & policy = default_alloc_policy());
     ~matrix();
 
     T get(unsigned int row, unsigned int col) const;
@@ -27,49 +41,141 @@ class matrix {
 
     void print();
 
+    // What the row major storage ended up backed by
+    page_kind backing() const;
+
     template <class K>
-    friend matrix<K> * matmul_cpu_cache_block(matrix<K> * m1, matrix<K> * m2, size_t block_size);
+    friend matrix<K> * matmul_cpu_cache_block(matrix<K> * m1, matrix<K> * m2, size_t block_size, const epilogue<K> & ep);
     template <class K>
     friend matrix<K> * matmul_cpu(matrix<K> * m1, matrix<K> * m2);
     friend matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2);
     friend matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2);
     friend matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2);
     friend matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2);
+    friend matrix<float> * matmul_cpu_sse(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+    friend matrix<double> * matmul_cpu_sse(matrix<double> * m1, matrix<double> * m2, const epilogue<double> & ep);
+    friend matrix<uint32_t> * matmul_cpu_sse(matrix<uint32_t> * m1, matrix<uint32_t> * m2, const epilogue<uint32_t> & ep);
+    friend matrix<uint16_t> * matmul_cpu_sse(matrix<uint16_t> * m1, matrix<uint16_t> * m2, const epilogue<uint16_t> & ep);
     
 
     friend matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2);
     friend matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2);
+    friend matrix<float> * matmul_cpu_avx(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+    friend matrix<float> * matmul_cpu_avxfma(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+
+    // Half width storage, widened on load and accumulated in fp32.
+    // The _narrow variants round the result back down to the storage type.
+    friend matrix<float> * matmul_cpu_f16c(matrix<float16> * m1, matrix<float16> * m2);
+    friend matrix<float16> * matmul_cpu_f16c_narrow(matrix<float16> * m1, matrix<float16> * m2);
+    friend matrix<float> * matmul_cpu_bf16(matrix<bfloat16> * m1, matrix<bfloat16> * m2);
+    friend matrix<bfloat16> * matmul_cpu_bf16_narrow(matrix<bfloat16> * m1, matrix<bfloat16> * m2);
+    friend matrix<float> * matmul_cpu_f16c(matrix<float16> * m1, matrix<float16> * m2, const epilogue<float> & ep);
+    friend matrix<float16> * matmul_cpu_f16c_narrow(matrix<float16> * m1, matrix<float16> * m2, const epilogue<float, float16> & ep);
+    friend matrix<float> * matmul_cpu_bf16(matrix<bfloat16> * m1, matrix<bfloat16> * m2, const epilogue<float> & ep);
+    friend matrix<bfloat16> * matmul_cpu_bf16_narrow(matrix<bfloat16> * m1, matrix<bfloat16> * m2, const epilogue<float, bfloat16> & ep);
+
+    // Sparse left hand side times dense right hand side, see sparse.h
+    template <class K>
+    friend matrix<K> * matmul_csr(const csr_matrix<K> * m1, matrix<K> * m2, const epilogue<K> & ep);
+    template <class K>
+    friend matrix<K> * matmul_bsr(const bsr_matrix<K> * m1, matrix<K> * m2, const epilogue<K> & ep);
+    template <class K>
+    friend bool density_at_most(const matrix<K> * m, double fraction);
+    friend matrix<float> * matmul_csr(const csr_matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+    friend matrix<float> * matmul_bsr(const bsr_matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+
+    // Narrow shapes: matrix-vector, few columns in m2, few rows in m1. See skinny.h
+    template <class K>
+    friend matrix<K> * matmul_gemv(matrix<K> * m1, matrix<K> * m2, const epilogue<K> & ep);
+    template <class K>
+    friend matrix<K> * matmul_tall_skinny(matrix<K> * m1, matrix<K> * m2, const epilogue<K> & ep);
+    template <class K>
+    friend matrix<K> * matmul_short_wide(matrix<K> * m1, matrix<K> * m2, const epilogue<K> & ep);
+    friend matrix<float> * matmul_gemv(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+    friend matrix<float> * matmul_tall_skinny(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+    friend matrix<float> * matmul_short_wide(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep);
+
+    // Operands packed once and reused across multiplies, see packed.h
+    template <class K>
+    friend void pack_panel(const matrix<K> * m, unsigned int p, packed_matrix<K> * dest);
+    template <class K>
+    friend void matmul_packed_block(const matrix<K> * m1, const packed_matrix<K> & m2,
+                                    unsigned int row_begin, unsigned int row_end, unsigned int p0, unsigned int p1,
+                                    matrix<K> * res, const epilogue<K> & ep);
+    friend void matmul_packed_block(const matrix<float> * m1, const packed_matrix<float> & m2,
+                                    unsigned int row_begin, unsigned int row_end, unsigned int p0, unsigned int p1,
+                                    matrix<float> * res, const epilogue<float> & ep);
+
+    // Symmetric and triangular products, see triangular.h
+    template <class K>
+    friend matrix<K> * matmul_syrk(matrix<K> * a, bool trans, const epilogue<K> & ep);
+    template <class K>
+    friend matrix<K> * matmul_trmm(matrix<K> * m1, matrix<K> * m2, tri_side side, triangle uplo, const epilogue<K> & ep);
+    friend matrix<float> * matmul_syrk(matrix<float> * a, bool trans, const epilogue<float> & ep);
+    friend matrix<float> * matmul_trmm(matrix<float> * m1, matrix<float> * m2, tri_side side, triangle uplo,
+                                       const epilogue<float> & ep);
+
+    // Multiply with either operand transposed, used by the expressions in expr.h
+    template <class K>
+    friend matrix<K> * matmul_transposed(const matrix<K> * m1, bool trans1, const matrix<K> * m2, bool trans2);
+    template <class K>
+    friend void matmul_into(const matrix<K> * m1, bool trans1, const matrix<K> * m2, bool trans2,
+                            matrix<K> * res, bool accumulate);
 
 
   private:
-    std::vector<T> * _internal_getRow(unsigned int row);
-    std::vector<T> * _internal_getCol(unsigned int col);
-    void _transpose(std::vector<std::vector<T>> * dest, std::vector<std::vector<T>> * src);
+    row_type * _internal_getRow(unsigned int row);
+    row_type * _internal_getCol(unsigned int col);
+    void _transpose(storage_type * dest, storage_type * src);
     void _internal_populate_col_maj();
+    // Turn an empty matrix into the transpose of m, sharing m's storage
+    // with the two copies' roles traded.  The storage stays m's: it is not
+    // freed when this matrix is destroyed.
+    void _internal_borrow_transpose(const matrix<T> * m);
 
     unsigned int _nElementBytes;
-    std::vector<std::vector<T>> * _elements;
-    std::vector<std::vector<T>> * _elements_col_maj;
+    storage_type * _elements;
+    storage_type * _elements_col_maj;
+    // Arenas the rows of each copy were taken from, null under the heap policy
+    row_arena * _arena;
+    row_arena * _arena_col_maj;
+    // Whether the storage belongs to another matrix, see _internal_borrow_transpose
+    bool _borrowed;
 };
 
 template <class T>
-matrix<T>::matrix(unsigned int nRows, unsigned int nCols) {
-  this->_elements = new std::vector<std::vector<T>>;
-  this->_elements_col_maj = new std::vector<std::vector<T>>;
+matrix<T>::matrix(unsigned int nRows, unsigned int nCols, const alloc_policy & policy) {
+  this->_elements = new storage_type;
+  this->_elements_col_maj = new storage_type;
   this->rows = nRows;
   this->cols = nCols;
-  _elements->resize(nRows);
-  _elements_col_maj->resize(nCols);
-  for (int i = 0; i < nRows; i++) (*_elements)[i].resize(nCols);
-  for (int i = 0; i < nCols; i++) (*_elements_col_maj)[i].resize(nRows);
+  this->_borrowed = false;
+  // Arenas are placed (first touched) before any row is constructed in them
+  this->_arena = make_row_arena<T>(nRows, nCols, policy);
+  this->_arena_col_maj = make_row_arena<T>(nCols, nRows, policy);
+  _elements->reserve(nRows);
+  _elements_col_maj->reserve(nCols);
+  for (int i = 0; i < nRows; i++) _elements->emplace_back(nCols, row_allocator<T>(_arena));
+  for (int i = 0; i < nCols; i++) _elements_col_maj->emplace_back(nRows, row_allocator<T>(_arena_col_maj));
 }
 
 template <class T>
 matrix<T>::~matrix() {
+  if (this->_borrowed) return;
   // this->_elements->resize(0);
   // this->_elements_col_maj->resize(0);
   delete this->_elements;
   delete this->_elements_col_maj;
+  // The rows are gone, so the arenas they lived in can go too
+  delete this->_arena;
+  delete this->_arena_col_maj;
+}
+
+template <class T>
+page_kind matrix<T>::backing() const {
+  if (this->rows == 0 || this->cols == 0) return page_kind::heap;
+  if (_arena != nullptr && _arena->owns((*_elements)[0].data())) return _arena->backing();
+  return page_kind::heap;
 }
 
 template <class T>
@@ -90,11 +196,27 @@ void matrix<T>::_internal_populate_col_maj() {
     this->_transpose(this->_elements_col_maj, this->_elements);
 }
 
+template <class T>
+void matrix<T>::_internal_borrow_transpose(const matrix<T> * m) {
+  assert(this->rows == 0 && this->cols == 0);
+  delete this->_elements;
+  delete this->_elements_col_maj;
+  delete this->_arena;
+  delete this->_arena_col_maj;
+  this->_arena = nullptr;
+  this->_arena_col_maj = nullptr;
+  this->rows = m->cols;
+  this->cols = m->rows;
+  this->_elements = m->_elements_col_maj;
+  this->_elements_col_maj = m->_elements;
+  this->_borrowed = true;
+}
+
 // Used to pull a row from the _elements variable (row major)
 // Does not require that _elements_col_major be up to date
 // Will use the regular element storage in _elements
 template <class T>
-std::vector<T> * matrix<T>::_internal_getRow(unsigned int row) {
+typename matrix<T>::row_type * matrix<T>::_internal_getRow(unsigned int row) {
   assert(row >= 0 && row < this->rows);
   return &(this->_elements->at(row));
 }
@@ -103,7 +225,7 @@ std::vector<T> * matrix<T>::_internal_getRow(unsigned int row) {
 // Note that the callee must first ensure that _elements_col_major
 // is up to date by calling _internal_populate_col_major
 template <class T>
-std::vector<T> * matrix<T>::_internal_getCol(unsigned int col) {
+typename matrix<T>::row_type * matrix<T>::_internal_getCol(unsigned int col) {
   assert(col >= 0 && col < this-> cols);
   return &(this->_elements_col_maj->at(cols));
 }
@@ -111,7 +233,7 @@ std::vector<T> * matrix<T>::_internal_getCol(unsigned int col) {
 // Internal transpose function that returns pointer to the transposed
 // elements.  Used by the regular transpose function.
 template <class T>
-void matrix<T>::_transpose(std::vector<std::vector<T>> * dest, std::vector<std::vector<T>> * src) {
+void matrix<T>::_transpose(storage_type * dest, storage_type * src) {
   dest->resize(this->cols);
   for (int i = 0; i < this->cols; i++) (*dest)[i].resize(this->rows);
   for (int i = 0; i < this->rows; i++) {
@@ -165,6 +287,10 @@ void matrix<T>::transpose() {
   const auto tmpElem = this->_elements;
   this->_elements = _elements_col_maj;
   this->_elements_col_maj = tmpElem;
+  // Each copy keeps the arena its rows were taken from
+  const auto tmpArena = this->_arena;
+  this->_arena = _arena_col_maj;
+  this->_arena_col_maj = tmpArena;
 }
 
 template <class T>
@@ -220,16 +346,20 @@ matrix<T> * matmul_cpu(matrix<T> * m1, matrix<T> * m2) {
 // the row-major data is created and transposed and is stored
 // internally. No preloading is done, only "blocking."
 // See: https://www.youtube.com/watch?v=G92BCtfTwOE
+// The epilogue (see epilogue.h) is applied to each accumulator before it is stored.
 // Note: This function is a friend of matrix - private members are used.
 template <class T>
-matrix<T> * matmul_cpu_cache_block(matrix<T> * m1, matrix<T> * m2, size_t block_size) {
+matrix<T> * matmul_cpu_cache_block(matrix<T> * m1, matrix<T> * m2, size_t block_size, const epilogue<T> & ep) {
   // Make sure that matrices match 1's cols to 2's rows
   assert(m1->cols == m2->rows);
 
   // TODO: Make this work for all block sizes
   // Make sure that the block size evenly divides the shared dimension
   // assert(m1->cols % block_size == 0);
-  long long int acc = 0;
+
+  // Accumulate in whatever type a product of two T's has, so floats are
+  // not truncated and small integer types are promoted.
+  decltype(T() * T()) acc = 0;
 
   // Store the original dimensions of the matrix
   unsigned int m1_rows = m1->rows;
@@ -258,9 +388,9 @@ matrix<T> * matmul_cpu_cache_block(matrix<T> * m1, matrix<T> * m2, size_t block_
 
           // do the dot product of m1 row with m2 column
           for (int k = 0; k < m1->cols; k++) {
-              acc += (*m1->_elements)[row + rowBlockIndex][k] * (*m2->_elements)[col + colBlockIndex][k];
+              acc += (*m1->_elements)[row + rowBlockIndex][k] * (*m2->_elements_col_maj)[col + colBlockIndex][k];
           }
-          res->set(row + rowBlockIndex, col + colBlockIndex, acc);
+          res->set(row + rowBlockIndex, col + colBlockIndex, ep.apply(acc, row + rowBlockIndex, col + colBlockIndex));
           acc = 0;
         }
       }
@@ -269,4 +399,9 @@ matrix<T> * matmul_cpu_cache_block(matrix<T> * m1, matrix<T> * m2, size_t block_
   return res;
 }
 
+template <class T>
+matrix<T> * matmul_cpu_cache_block(matrix<T> * m1, matrix<T> * m2, size_t block_size) {
+  return matmul_cpu_cache_block(m1, m2, block_size, epilogue<T>());
+}
+
 #endif //MATRIX_H
\ No newline at end of file
@@ -1,4 +1,46 @@
 #ifndef MATMUL_H
+#define MATMUL_H
 #include "matrix.h"
+#include "sparse.h"
+#include "skinny.h"
+#include "packed.h"
 
-#endif //MATMUL_H
\ No newline at end of file
+// General multiply entry point.  Looks at the operands and picks the kernel
+// best suited to them, so callers don't have to.
+//
+// Narrow shapes are checked first: a single column in m2 is a matrix-vector
+// product, and up to skinny_max_dim columns in m2 (or rows in m1) go to the
+// skinny kernels.  These are memory bound, so the extra pass over m1 that
+// the density check would cost is not worth paying for them.
+//
+// Otherwise, a left hand side at or below sparse_density_threshold nonzeros is
+// converted to CSR and multiplied with the sparse kernel, which skips the
+// zeros entirely.  The check stops counting once the threshold is passed.
+// Everything else goes through the packed kernel (see packed.h): m2 is
+// packed for the running CPU, so float operands get the AVX2 register
+// tiled kernel where it is available, and other types the blocked generic
+// one.
+//
+// The epilogue is handed to whichever kernel is picked, see epilogue.h.
+template <class T>
+matrix<T> * matmul(matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  if (m2->cols == 1) return matmul_gemv(m1, m2, ep);
+  if (m2->cols <= skinny_max_dim) return matmul_tall_skinny(m1, m2, ep);
+  if (m1->rows <= skinny_max_dim) return matmul_short_wide(m1, m2, ep);
+
+  if (density_at_most(m1, sparse_density_threshold)) {
+    csr_matrix<T> sparse_m1(m1);
+    return matmul_csr(&sparse_m1, m2, ep);
+  }
+  return matmul_packed(m1, *pack(m2), ep);
+}
+
+template <class T>
+matrix<T> * matmul(matrix<T> * m1, matrix<T> * m2) {
+  return matmul(m1, m2, epilogue<T>());
+}
+
+#endif //MATMUL_H
@@ -0,0 +1,126 @@
+#include "packed.h"
+
+// AVX2 FMA kernel for float operands packed with pack_isa::avx2.
+// Panels are 16 floats wide, so a 4 row x 16 column tile of the result
+// is eight YMM accumulators.  For each depth block, the tile is loaded
+// from the row block buffer, updated with one broadcast of m1 and two
+// panel loads per step of the shared dimension, and written back.
+
+// c (4 rows, stride `stride`) += a[0..3][k0..k1) * panel rows k0..k1
+static void packed_tile_avxfma(const float * const * a, unsigned int k0, unsigned int k1,
+                               const float * b, float * c, unsigned int stride) {
+  __m256 c00 = _mm256_loadu_ps(c), c01 = _mm256_loadu_ps(c + 8);
+  __m256 c10 = _mm256_loadu_ps(c + stride), c11 = _mm256_loadu_ps(c + stride + 8);
+  __m256 c20 = _mm256_loadu_ps(c + 2 * stride), c21 = _mm256_loadu_ps(c + 2 * stride + 8);
+  __m256 c30 = _mm256_loadu_ps(c + 3 * stride), c31 = _mm256_loadu_ps(c + 3 * stride + 8);
+  for (unsigned int k = k0; k < k1; k++, b += 16) {
+    const __m256 b0 = _mm256_loadu_ps(b);
+    const __m256 b1 = _mm256_loadu_ps(b + 8);
+    __m256 a0 = _mm256_set1_ps(a[0][k]);
+    c00 = _mm256_fmadd_ps(a0, b0, c00);
+    c01 = _mm256_fmadd_ps(a0, b1, c01);
+    a0 = _mm256_set1_ps(a[1][k]);
+    c10 = _mm256_fmadd_ps(a0, b0, c10);
+    c11 = _mm256_fmadd_ps(a0, b1, c11);
+    a0 = _mm256_set1_ps(a[2][k]);
+    c20 = _mm256_fmadd_ps(a0, b0, c20);
+    c21 = _mm256_fmadd_ps(a0, b1, c21);
+    a0 = _mm256_set1_ps(a[3][k]);
+    c30 = _mm256_fmadd_ps(a0, b0, c30);
+    c31 = _mm256_fmadd_ps(a0, b1, c31);
+  }
+  _mm256_storeu_ps(c, c00);
+  _mm256_storeu_ps(c + 8, c01);
+  _mm256_storeu_ps(c + stride, c10);
+  _mm256_storeu_ps(c + stride + 8, c11);
+  _mm256_storeu_ps(c + 2 * stride, c20);
+  _mm256_storeu_ps(c + 2 * stride + 8, c21);
+  _mm256_storeu_ps(c + 3 * stride, c30);
+  _mm256_storeu_ps(c + 3 * stride + 8, c31);
+}
+
+void matmul_packed_block(const matrix<float> * m1, const packed_matrix<float> & m2,
+                         unsigned int row_begin, unsigned int row_end, unsigned int p0, unsigned int p1,
+                         matrix<float> * res, const epilogue<float> & ep) {
+  if (m2.isa != pack_isa::avx2) return matmul_packed_block<float>(m1, m2, row_begin, row_end, p0, p1, res, ep);
+  assert(m1->cols == m2.rows);
+  assert(m2.panel_width == 16);
+
+  const unsigned int depth = m2.rows;
+  const unsigned int first = p0 * 16;
+  const unsigned int span = std::min(p1 * 16, m2.cols) - first;
+  const unsigned int padded = (p1 - p0) * 16;
+
+  std::vector<float> tile((size_t) packed_row_block * padded);
+  float buf[8];
+  for (unsigned int i = row_begin; i < row_end; i += packed_row_block) {
+    const unsigned int count = std::min(packed_row_block, row_end - i);
+    // A short last block repeats its final row; the extra results are dropped
+    const float * a[packed_row_block];
+    for (unsigned int r = 0; r < packed_row_block; r++) {
+      a[r] = (*m1->_elements)[i + std::min(r, count - 1)].data();
+    }
+
+    std::fill(tile.begin(), tile.end(), 0.0f);
+    for (unsigned int k0 = 0; k0 < depth; k0 += m2.depth_block) {
+      const unsigned int k1 = std::min(depth, k0 + m2.depth_block);
+      for (unsigned int p = p0; p < p1; p++) {
+        packed_tile_avxfma(a, k0, k1, m2.panel(p) + (size_t) k0 * 16, &tile[(p - p0) * 16], padded);
+      }
+    }
+
+    for (unsigned int r = 0; r < count; r++) {
+      for (unsigned int j = 0; j < span; j += 8) {
+        const unsigned int width = std::min(8u, span - j);
+        __m256 val = _mm256_loadu_ps(&tile[(size_t) r * padded + j]);
+        _mm256_storeu_ps(buf, epilogue_apply_ps(ep, val, i + r, first + j, width));
+        for (unsigned int w = 0; w < width; w++) {
+          (*res->_elements)[i + r][first + j + w] = buf[w];
+          (*res->_elements_col_maj)[first + j + w][i + r] = buf[w];
+        }
+      }
+    }
+  }
+}
+
+void matmul_packed_acc(const float * a, unsigned int lda, unsigned int rows, const packed_matrix<float> & m2,
+                       float * c, unsigned int ldc, const epilogue<float> & ep) {
+  if (m2.isa != pack_isa::avx2) return matmul_packed_acc<float>(a, lda, rows, m2, c, ldc, ep);
+  assert(pack_isa_supported(m2.isa));
+  assert(m2.panel_width == 16);
+
+  const unsigned int depth = m2.rows;
+  const unsigned int padded = m2.panel_count() * 16;
+
+  auto bounds = packed_partition(rows, (size_t) rows * depth * m2.cols);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    std::vector<float> tile((size_t) packed_row_block * padded);
+    for (unsigned int i = begin; i < end; i += packed_row_block) {
+      const unsigned int count = std::min(packed_row_block, end - i);
+      // A short last block repeats its final row; the extra results are dropped
+      const float * a_rows[packed_row_block];
+      for (unsigned int r = 0; r < packed_row_block; r++) {
+        a_rows[r] = a + (size_t) (i + std::min(r, count - 1)) * lda;
+      }
+
+      std::fill(tile.begin(), tile.end(), 0.0f);
+      for (unsigned int k0 = 0; k0 < depth; k0 += m2.depth_block) {
+        const unsigned int k1 = std::min(depth, k0 + m2.depth_block);
+        for (unsigned int p = 0; p < m2.panel_count(); p++) {
+          packed_tile_avxfma(a_rows, k0, k1, m2.panel(p) + (size_t) k0 * 16, &tile[p * 16], padded);
+        }
+      }
+
+      for (unsigned int r = 0; r < count; r++) {
+        float * out = c + (size_t) (i + r) * ldc;
+        const float * sum = &tile[(size_t) r * padded];
+        unsigned int j = 0;
+        for (; j + 8 <= m2.cols; j += 8) {
+          const __m256 val = _mm256_add_ps(_mm256_loadu_ps(out + j), _mm256_loadu_ps(sum + j));
+          _mm256_storeu_ps(out + j, epilogue_apply_ps(ep, val, i + r, j, 8));
+        }
+        for (; j < m2.cols; j++) out[j] = ep.apply(out[j] + sum[j], i + r, j);
+      }
+    }
+  });
+}
@@ -0,0 +1,248 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "matrix.h"
+#include "parallel.h"
+
+// Pre-packed right hand operands.
+//
+// When the same m2 (say a weight matrix) is multiplied against many
+// different m1's, rearranging it into the layout the kernel wants on every
+// call is wasted work.  pack() does it once and returns an immutable
+// handle that any number of multiplies, on any number of threads, can use
+// directly.
+//
+// The layout is a sequence of panels, each panel_width columns wide and
+// covering all rows of m2.  Within a panel, the panel_width values of row k
+// are contiguous and rows follow each other, so the kernel reads a panel
+// front to back with one vector load per row.  The last panel is zero
+// padded.  Any run of depth_block rows of a panel is contiguous as well;
+// the kernel walks the shared dimension in runs of that length so the
+// matching slice of m1 stays in L1.
+
+// Instruction set a packed operand is laid out for
+enum class pack_isa { generic, avx2 };
+
+// Rows of m1 the packed kernels compute at once
+const unsigned int packed_row_block = 4;
+
+// Below this many multiply-adds per thread the packed kernels don't spawn threads
+const size_t packed_parallel_grain = 1 << 18;
+
+template <class T>
+class packed_matrix {
+
+  public:
+    // Shape of the original matrix
+    const unsigned int rows;
+    const unsigned int cols;
+    // Block sizes the data is laid out for
+    const unsigned int panel_width;
+    const unsigned int depth_block;
+    const pack_isa isa;
+
+    packed_matrix(unsigned int rows, unsigned int cols, pack_isa isa,
+                  unsigned int panel_width, unsigned int depth_block)
+      : rows(rows), cols(cols), panel_width(panel_width), depth_block(depth_block), isa(isa),
+        _data((size_t) panel_count() * rows * panel_width) {}
+
+    unsigned int panel_count() const { return (cols + panel_width - 1) / panel_width; }
+    const T * panel(unsigned int p) const { return &_data[(size_t) p * rows * panel_width]; }
+    T * panel(unsigned int p) { return &_data[(size_t) p * rows * panel_width]; }
+
+  private:
+    std::vector<T> _data;
+};
+
+// Handles are shared and read only
+template <class T>
+using packed_handle = std::shared_ptr<const packed_matrix<T>>;
+
+// Best layout the running CPU can use
+inline pack_isa best_pack_isa() {
+  return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? pack_isa::avx2 : pack_isa::generic;
+}
+
+// Whether the running CPU can run kernels for isa
+inline bool pack_isa_supported(pack_isa isa) {
+  return isa == pack_isa::generic || best_pack_isa() == pack_isa::avx2;
+}
+
+// Panel width and depth block for each layout.  The AVX2 float kernel holds
+// a 4 x 16 tile of the result in eight YMM registers; a 256 deep slice of a
+// panel is 16KB, half a typical L1.
+template <class T>
+void pack_block_sizes(pack_isa isa, unsigned int * panel_width, unsigned int * depth_block) {
+  *panel_width = isa == pack_isa::avx2 ? 32 / sizeof(T) * 2 : 8;
+  *depth_block = 256;
+}
+
+// Copy panel p of m into its place in dest
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+void pack_panel(const matrix<T> * m, unsigned int p, packed_matrix<T> * dest) {
+  const unsigned int nr = dest->panel_width;
+  const unsigned int first = p * nr;
+  const unsigned int width = std::min(nr, m->cols - first);
+  T * out = dest->panel(p);
+  for (unsigned int k = 0; k < m->rows; k++) {
+    const T * row = (*m->_elements)[k].data() + first;
+    for (unsigned int j = 0; j < width; j++) out[j] = row[j];
+    for (unsigned int j = width; j < nr; j++) out[j] = T(0);
+    out += nr;
+  }
+}
+
+// Pack m for the packed kernels.  The handle does not refer back to m.
+template <class T>
+packed_handle<T> pack(const matrix<T> * m, pack_isa isa = best_pack_isa()) {
+  unsigned int panel_width, depth_block;
+  pack_block_sizes<T>(isa, &panel_width, &depth_block);
+  auto packed = std::make_shared<packed_matrix<T>>(m->rows, m->cols, isa, panel_width, depth_block);
+  for (unsigned int p = 0; p < packed->panel_count(); p++) pack_panel(m, p, packed.get());
+  return packed;
+}
+
+// Pack a dest->rows x dest->cols row major buffer, whose rows are ld apart,
+// into dest.  For operands that don't live in a matrix, e.g. the panels
+// the workers of matmul_summa exchange.
+template <class T>
+void pack_buffer(const T * m, unsigned int ld, packed_matrix<T> * dest) {
+  const unsigned int nr = dest->panel_width;
+  for (unsigned int p = 0; p < dest->panel_count(); p++) {
+    const unsigned int first = p * nr;
+    const unsigned int width = std::min(nr, dest->cols - first);
+    T * out = dest->panel(p);
+    for (unsigned int k = 0; k < dest->rows; k++) {
+      const T * row = m + (size_t) k * ld + first;
+      for (unsigned int j = 0; j < width; j++) out[j] = row[j];
+      for (unsigned int j = width; j < nr; j++) out[j] = T(0);
+      out += nr;
+    }
+  }
+}
+
+inline std::vector<unsigned int> packed_partition(unsigned int rows, size_t work) {
+  unsigned int blocks = (rows + packed_row_block - 1) / packed_row_block;
+  size_t parts = std::min<size_t>(hardware_threads(), work / packed_parallel_grain + 1);
+  auto bounds = balanced_partition(blocks, [](unsigned int i) { return (size_t) i; }, parts);
+  for (auto & b : bounds) b = std::min(rows, b * packed_row_block);
+  return bounds;
+}
+
+// Rows [row_begin, row_end) and panels [p0, p1) of m1 times a packed m2,
+// stored with ep applied in both copies of res.  Rows of m1 are taken
+// packed_row_block at a time; for every depth block, that slice of the rows
+// is multiplied against the same slice of each panel in the range,
+// accumulating into a row block buffer that the epilogue is applied to once
+// at the end.  matmul_packed runs it on row ranges, the pipelined
+// multiplies in async.h on column blocks.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+void matmul_packed_block(const matrix<T> * m1, const packed_matrix<T> & m2,
+                         unsigned int row_begin, unsigned int row_end, unsigned int p0, unsigned int p1,
+                         matrix<T> * res, const epilogue<T> & ep) {
+  assert(m1->cols == m2.rows);
+  const unsigned int nr = m2.panel_width;
+  const unsigned int depth = m2.rows;
+  const unsigned int first = p0 * nr;
+  const unsigned int span = std::min(p1 * nr, m2.cols) - first;
+  const unsigned int padded = (p1 - p0) * nr;
+
+  std::vector<decltype(T() * T())> tile((size_t) packed_row_block * padded);
+  for (unsigned int i = row_begin; i < row_end; i += packed_row_block) {
+    const unsigned int count = std::min(packed_row_block, row_end - i);
+    std::fill(tile.begin(), tile.end(), 0);
+    for (unsigned int k0 = 0; k0 < depth; k0 += m2.depth_block) {
+      const unsigned int k1 = std::min(depth, k0 + m2.depth_block);
+      for (unsigned int p = p0; p < p1; p++) {
+        const T * b = m2.panel(p) + (size_t) k0 * nr;
+        for (unsigned int k = k0; k < k1; k++, b += nr) {
+          for (unsigned int r = 0; r < count; r++) {
+            const T a = (*m1->_elements)[i + r][k];
+            auto * c = &tile[(size_t) r * padded + (p - p0) * nr];
+            for (unsigned int j = 0; j < nr; j++) c[j] += a * b[j];
+          }
+        }
+      }
+    }
+    for (unsigned int r = 0; r < count; r++) {
+      for (unsigned int j = 0; j < span; j++) {
+        T val = ep.apply(tile[(size_t) r * padded + j], i + r, first + j);
+        (*res->_elements)[i + r][first + j] = val;
+        (*res->_elements_col_maj)[first + j][i + r] = val;
+      }
+    }
+  }
+}
+
+void matmul_packed_block(const matrix<float> * m1, const packed_matrix<float> & m2,
+                         unsigned int row_begin, unsigned int row_end, unsigned int p0, unsigned int p1,
+                         matrix<float> * res, const epilogue<float> & ep);
+
+// Multiply m1 by a packed m2, splitting the rows of m1 across threads
+template <class T>
+matrix<T> * matmul_packed(matrix<T> * m1, const packed_matrix<T> & m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2.rows);
+  assert(pack_isa_supported(m2.isa));
+
+  const auto res = new matrix<T>(m1->rows, m2.cols);
+  auto bounds = packed_partition(m1->rows, (size_t) m1->rows * m2.rows * m2.cols);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    matmul_packed_block(m1, m2, begin, end, 0, m2.panel_count(), res, ep);
+  }, true);
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_packed(matrix<T> * m1, const packed_matrix<T> & m2) {
+  return matmul_packed(m1, m2, epilogue<T>());
+}
+
+// c = ep(c + a * m2) on row major buffers: a is rows x m2.rows with its
+// rows lda apart, c is rows x m2.cols with its rows ldc apart, and ep sees
+// indices into c.  The same blocking as matmul_packed.  A product built up
+// over several calls passes the identity epilogue to all but the last.
+template <class T>
+void matmul_packed_acc(const T * a, unsigned int lda, unsigned int rows, const packed_matrix<T> & m2,
+                       T * c, unsigned int ldc, const epilogue<T> & ep) {
+  assert(pack_isa_supported(m2.isa));
+  const unsigned int nr = m2.panel_width;
+  const unsigned int depth = m2.rows;
+  const unsigned int padded = m2.panel_count() * nr;
+
+  auto bounds = packed_partition(rows, (size_t) rows * depth * m2.cols);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    std::vector<decltype(T() * T())> tile((size_t) packed_row_block * padded);
+    for (unsigned int i = begin; i < end; i += packed_row_block) {
+      const unsigned int count = std::min(packed_row_block, end - i);
+      std::fill(tile.begin(), tile.end(), 0);
+      for (unsigned int k0 = 0; k0 < depth; k0 += m2.depth_block) {
+        const unsigned int k1 = std::min(depth, k0 + m2.depth_block);
+        for (unsigned int p = 0; p < m2.panel_count(); p++) {
+          const T * b = m2.panel(p) + (size_t) k0 * nr;
+          for (unsigned int k = k0; k < k1; k++, b += nr) {
+            for (unsigned int r = 0; r < count; r++) {
+              const T av = a[(size_t) (i + r) * lda + k];
+              auto * t = &tile[(size_t) r * padded + p * nr];
+              for (unsigned int j = 0; j < nr; j++) t[j] += av * b[j];
+            }
+          }
+        }
+      }
+      for (unsigned int r = 0; r < count; r++) {
+        T * out = c + (size_t) (i + r) * ldc;
+        for (unsigned int j = 0; j < m2.cols; j++) out[j] = T(ep.apply(out[j] + tile[(size_t) r * padded + j], i + r, j));
+      }
+    }
+  });
+}
+
+void matmul_packed_acc(const float * a, unsigned int lda, unsigned int rows, const packed_matrix<float> & m2,
+                       float * c, unsigned int ldc, const epilogue<float> & ep);
+
+#endif //PACKED_H
@@ -0,0 +1,159 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sched.h>
+
+// Upper bound on hardware_threads() for the calling thread, 0 for none.
+// Set by code that runs several multiplies side by side so they don't
+// oversubscribe the machine, e.g. the workers of a distributed multiply
+// sharing one machine, or the executor's pool threads (see executor.h),
+// which already run one per core and so multiply on their own thread.
+inline unsigned int & parallel_thread_limit() {
+  static thread_local unsigned int limit = 0;
+  return limit;
+}
+
+// Number of threads the parallel kernels split work across
+inline unsigned int hardware_threads() {
+  unsigned int n = std::thread::hardware_concurrency();
+  if (n == 0) n = 1;
+  const unsigned int limit = parallel_thread_limit();
+  return limit != 0 && limit < n ? limit : n;
+}
+
+// NUMA topology.  Each entry is one memory node and lists the CPUs that
+// are local to it.  Read from sysfs once; a machine without the node
+// directory (or with a single node) is treated as one node with no CPU
+// list, which turns pinning and node placement into no-ops.
+
+// Parse a sysfs cpulist such as "0-3,8,10-11"
+inline std::vector<int> parse_cpulist(const std::string & list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    const std::string item = list.substr(pos, end - pos);
+    const size_t dash = item.find('-');
+    if (!item.empty() && item[0] >= '0' && item[0] <= '9') {
+      const int first = std::stoi(item);
+      const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+      for (int c = first; c <= last; c++) cpus.push_back(c);
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+// Read node0, node1, ... under root until one is missing
+inline std::vector<std::vector<int>> read_numa_topology(const std::string & root = "/sys/devices/system/node") {
+  std::vector<std::vector<int>> nodes;
+  for (unsigned int n = 0; ; n++) {
+    std::ifstream in(root + "/node" + std::to_string(n) + "/cpulist");
+    std::string list;
+    if (!in || !std::getline(in, list)) break;
+    nodes.push_back(parse_cpulist(list));
+  }
+  if (nodes.empty()) nodes.resize(1);
+  return nodes;
+}
+
+inline std::vector<std::vector<int>> & numa_node_table() {
+  static std::vector<std::vector<int>> nodes = read_numa_topology();
+  return nodes;
+}
+
+inline const std::vector<std::vector<int>> & numa_nodes() {
+  return numa_node_table();
+}
+
+// Replace the detected topology, e.g. to restrict placement to some nodes or
+// to exercise the multi-node paths on a single node machine.  Not thread
+// safe; call it before any parallel work starts.
+inline void set_numa_nodes(const std::vector<std::vector<int>> & nodes) {
+  numa_node_table() = nodes.empty() ? std::vector<std::vector<int>>(1) : nodes;
+}
+
+// Restrict the calling thread to the CPUs of node.  Returns false (and
+// leaves the affinity alone) when the node has no CPU list.
+inline bool pin_to_node(unsigned int node) {
+  const auto & nodes = numa_nodes();
+  if (node >= nodes.size() || nodes[node].empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c : nodes[node]) {
+    if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Node holding row `row` of `rows` rows placed with first touch (see
+// placement.h), which gives node n the n-th of `nodes` equal slices.
+inline unsigned int node_of_row(unsigned int row, unsigned int rows, unsigned int nodes) {
+  return rows == 0 ? 0 : (unsigned int) ((unsigned long long) row * nodes / rows);
+}
+
+// Split [0, n) into at most nParts contiguous ranges of roughly equal work.
+// prefix(i) must return the total work of items [0, i), so prefix(0) == 0
+// and prefix(n) is the total.  Returns the range boundaries: range p is
+// [bounds[p], bounds[p + 1]).
+template <class W>
+std::vector<unsigned int> balanced_partition(unsigned int n, W prefix, unsigned int nParts) {
+  if (nParts > n) nParts = n;
+  if (nParts == 0) nParts = 1;
+
+  std::vector<unsigned int> bounds(nParts + 1);
+  bounds[0] = 0;
+  bounds[nParts] = n;
+  const double total = (double) prefix(n);
+
+  // Binary search for the first index whose prefix reaches each target.
+  // prefix is monotonic so the boundaries come out in order.
+  for (unsigned int p = 1; p < nParts; p++) {
+    const double target = total * p / nParts;
+    unsigned int lo = bounds[p - 1];
+    unsigned int hi = n;
+    while (lo < hi) {
+      unsigned int mid = lo + (hi - lo) / 2;
+      if ((double) prefix(mid) < target) lo = mid + 1;
+      else hi = mid;
+    }
+    bounds[p] = lo;
+  }
+  return bounds;
+}
+
+// Run body(begin, end) for every range in bounds, one thread per range.
+// The calling thread takes the first range itself.  When the ranges split
+// rows [0, bounds.back()) of a first touch placed matrix (row_partition)
+// on a machine with more than one NUMA node, each worker is pinned to the
+// node holding the middle row of its range (see node_of_row), however the
+// ranges were balanced.  Other partitions, e.g. column strips, say nothing
+// about where their data lives and run unpinned.  The calling thread's
+// affinity is left alone.
+template <class F>
+void parallel_ranges(const std::vector<unsigned int> & bounds, F body, bool row_partition = false) {
+  std::vector<std::thread> workers;
+  const unsigned int nodes = row_partition ? numa_nodes().size() : 1;
+  const unsigned int rows = bounds.empty() ? 0 : bounds.back();
+  for (size_t p = 1; p + 1 < bounds.size(); p++) {
+    if (bounds[p] == bounds[p + 1]) continue;
+    if (nodes > 1) {
+      const unsigned int node = node_of_row(bounds[p] + (bounds[p + 1] - bounds[p]) / 2, rows, nodes);
+      workers.emplace_back([&body, node](unsigned int begin, unsigned int end) {
+        pin_to_node(node);
+        body(begin, end);
+      }, bounds[p], bounds[p + 1]);
+    } else {
+      workers.emplace_back(body, bounds[p], bounds[p + 1]);
+    }
+  }
+  if (bounds.size() > 1 && bounds[0] != bounds[1]) body(bounds[0], bounds[1]);
+  for (auto & w : workers) w.join();
+}
+
+#endif //PARALLEL_H
@@ -0,0 +1,193 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+#include "parallel.h"
+
+// Where and how matrix storage is allocated.
+//
+// By default every row of a matrix is its own heap allocation on 4K pages,
+// faulted in by whichever thread constructed the matrix.  Large matrices
+// can instead carve all of their rows out of one mapping (an arena) that is
+//
+//  - backed by huge pages: explicit (MAP_HUGETLB) pages when the system has
+//    some reserved, otherwise transparent huge pages requested with
+//    madvise(MADV_HUGEPAGE), otherwise ordinary pages, and
+//  - placed by first touch: the arena is split into numa_nodes().size()
+//    slices of rows and each slice is faulted in by a thread pinned to its
+//    node, so parallel_ranges workers mostly read rows local to them.
+//
+// Every step falls back quietly, so the same policy works on a single node
+// machine without huge pages reserved.
+
+struct alloc_policy {
+  bool huge_pages;
+  bool first_touch;
+
+  // The default policy allocates every row on the heap, as before
+  alloc_policy() : huge_pages(false), first_touch(false) {}
+  alloc_policy(bool huge_pages, bool first_touch) : huge_pages(huge_pages), first_touch(first_touch) {}
+
+  bool uses_arena() const { return huge_pages || first_touch; }
+};
+
+// Policy used by matrices constructed without one, including the results
+// the kernels allocate.  Not thread safe; set it before any parallel work.
+inline alloc_policy & default_alloc_policy() {
+  static alloc_policy policy;
+  return policy;
+}
+
+inline void set_default_alloc_policy(const alloc_policy & policy) {
+  default_alloc_policy() = policy;
+}
+
+// What an arena ended up backed by
+enum class page_kind { heap, small_pages, transparent_huge, explicit_huge };
+
+// Rows start on cache line boundaries
+const size_t arena_alignment = 64;
+const size_t small_page_bytes = 4096;
+const size_t huge_page_bytes = 2 << 20;
+
+inline size_t round_up(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// One mapping that the rows of a matrix are taken from in order.  Rows are
+// never returned individually; the whole mapping is released with the arena.
+class row_arena {
+
+  public:
+    row_arena(size_t bytes, bool huge_pages) : _base(nullptr), _size(0), _used(0), _kind(page_kind::heap) {
+      bytes = round_up(bytes == 0 ? 1 : bytes, small_page_bytes);
+
+      // Explicit huge pages only exist if the administrator reserved some
+      if (huge_pages && bytes >= huge_page_bytes) {
+        const size_t size = round_up(bytes, huge_page_bytes);
+        void * p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+          _base = (char *) p;
+          _size = size;
+          _kind = page_kind::explicit_huge;
+          return;
+        }
+      }
+
+      // Transparent huge pages need 2MB aligned ranges, so over map and trim
+      const size_t slack = huge_pages ? huge_page_bytes : 0;
+      void * p = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p != MAP_FAILED) {
+        char * start = (char *) p;
+        if (slack != 0) {
+          char * aligned = (char *) round_up((size_t) start, huge_page_bytes);
+          if (aligned != start) munmap(start, aligned - start);
+          if (aligned + bytes != start + bytes + slack) munmap(aligned + bytes, start + slack - aligned);
+          start = aligned;
+        }
+        _base = start;
+        _size = bytes;
+        _kind = page_kind::small_pages;
+        if (huge_pages && madvise(_base, _size, MADV_HUGEPAGE) == 0) _kind = page_kind::transparent_huge;
+        return;
+      }
+
+      _base = (char *) ::operator new(bytes);
+      _size = bytes;
+    }
+
+    ~row_arena() {
+      if (_kind == page_kind::heap) ::operator delete(_base);
+      else munmap(_base, _size);
+    }
+
+    row_arena(const row_arena &) = delete;
+    row_arena & operator=(const row_arena &) = delete;
+
+    // Next bytes of the arena, or nullptr once it is used up
+    void * take(size_t bytes) {
+      const size_t need = round_up(bytes, arena_alignment);
+      if (need > _size - _used) return nullptr;
+      void * p = _base + _used;
+      _used += need;
+      return p;
+    }
+
+    bool owns(const void * p) const {
+      return (const char *) p >= _base && (const char *) p < _base + _size;
+    }
+
+    page_kind backing() const { return _kind; }
+
+    // Fault in count items of stride bytes each, node n touching the n-th
+    // slice from a thread pinned to it.  With a single node there is
+    // nothing to place and the pages are left to be touched on first use.
+    void first_touch(unsigned int count, size_t stride) {
+      const unsigned int nodes = numa_nodes().size();
+      if (nodes < 2 || count == 0) return;
+      auto bounds = balanced_partition(count, [](unsigned int i) { return (size_t) i; }, nodes);
+      std::vector<std::thread> touchers;
+      for (unsigned int n = 0; n + 1 < bounds.size(); n++) {
+        const size_t begin = bounds[n] * stride;
+        const size_t end = std::min(_size, bounds[n + 1] * stride);
+        if (begin >= end) continue;
+        const unsigned int node = node_of_row(bounds[n], count, nodes);
+        touchers.emplace_back([this, begin, end, node]() {
+          pin_to_node(node);
+          std::memset(_base + begin, 0, end - begin);
+        });
+      }
+      for (auto & t : touchers) t.join();
+    }
+
+  private:
+    char * _base;
+    size_t _size;
+    size_t _used;
+    page_kind _kind;
+};
+
+// Allocator for matrix rows.  Rows come from the arena while it lasts and
+// from the heap otherwise (no arena, or a row that grew after construction).
+template <class T>
+struct row_allocator {
+  typedef T value_type;
+
+  row_arena * arena;
+
+  row_allocator() : arena(nullptr) {}
+  explicit row_allocator(row_arena * arena) : arena(arena) {}
+  template <class U>
+  row_allocator(const row_allocator<U> & other) : arena(other.arena) {}
+
+  T * allocate(size_t n) {
+    void * p = arena != nullptr ? arena->take(n * sizeof(T)) : nullptr;
+    return (T *) (p != nullptr ? p : ::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T * p, size_t) {
+    if (arena == nullptr || !arena->owns(p)) ::operator delete(p);
+  }
+};
+
+template <class T, class U>
+bool operator==(const row_allocator<T> & a, const row_allocator<U> & b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const row_allocator<T> & a, const row_allocator<U> & b) { return a.arena != b.arena; }
+
+// Arena for count rows of n elements of T, or nullptr under the heap policy
+template <class T>
+row_arena * make_row_arena(unsigned int count, unsigned int n, const alloc_policy & policy) {
+  if (!policy.uses_arena()) return nullptr;
+  const size_t stride = round_up((size_t) n * sizeof(T), arena_alignment);
+  auto arena = new row_arena((size_t) count * stride, policy.huge_pages);
+  if (policy.first_touch) arena->first_touch(count, stride);
+  return arena;
+}
+
+#endif //PLACEMENT_H
@@ -0,0 +1,187 @@
+#include "skinny.h"
+
+// AVX FMA specializations of the skinny kernels for float.  Kernels that
+// hold result strips in YMM registers finish them with epilogue_apply_ps.
+
+static float hsum_ps(__m256 v) {
+  float buf[8];
+  _mm256_storeu_ps(buf, v);
+  return buf[0] + buf[1] + buf[2] + buf[3] + buf[4] + buf[5] + buf[6] + buf[7];
+}
+
+// Four rows of m1 are dotted with x at once so every load of x feeds
+// four independent FMA chains.
+matrix<float> * matmul_gemv(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m2->cols == 1);
+
+  const auto res = new matrix<float>(m1->rows, 1);
+  const float * x = m2->_elements_col_maj->at(0).data();
+  const unsigned int n = m1->cols;
+
+  auto bounds = skinny_partition(m1->rows, (size_t) m1->rows * n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    unsigned int i = begin;
+    for (; i + 4 <= end; i += 4) {
+      const float * r0 = m1->_elements->at(i).data();
+      const float * r1 = m1->_elements->at(i + 1).data();
+      const float * r2 = m1->_elements->at(i + 2).data();
+      const float * r3 = m1->_elements->at(i + 3).data();
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps();
+      __m256 acc3 = _mm256_setzero_ps();
+      unsigned int k = 0;
+      for (; k + 8 <= n; k += 8) {
+        __m256 x_seg = _mm256_loadu_ps(x + k);
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + k), x_seg, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(r1 + k), x_seg, acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(r2 + k), x_seg, acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(r3 + k), x_seg, acc3);
+      }
+      float sum[4] = { hsum_ps(acc0), hsum_ps(acc1), hsum_ps(acc2), hsum_ps(acc3) };
+      for (; k < n; k++) {
+        sum[0] += r0[k] * x[k];
+        sum[1] += r1[k] * x[k];
+        sum[2] += r2[k] * x[k];
+        sum[3] += r3[k] * x[k];
+      }
+      for (unsigned int r = 0; r < 4; r++) {
+        sum[r] = ep.apply(sum[r], i + r, 0);
+        (*res->_elements)[i + r][0] = sum[r];
+        (*res->_elements_col_maj)[0][i + r] = sum[r];
+      }
+    }
+    for (; i < end; i++) {
+      const float * row = m1->_elements->at(i).data();
+      __m256 acc = _mm256_setzero_ps();
+      unsigned int k = 0;
+      for (; k + 8 <= n; k += 8) acc = _mm256_fmadd_ps(_mm256_loadu_ps(row + k), _mm256_loadu_ps(x + k), acc);
+      float sum = hsum_ps(acc);
+      for (; k < n; k++) sum += row[k] * x[k];
+      sum = ep.apply(sum, i, 0);
+      (*res->_elements)[i][0] = sum;
+      (*res->_elements_col_maj)[0][i] = sum;
+    }
+  }, true);
+  return res;
+}
+
+// m2 is first copied into a K x 16 zero padded buffer so each of its rows
+// is exactly two YMM loads.  Four rows of the result (eight accumulators)
+// are built at a time: every element of m1 is broadcast once and every
+// load of m2 feeds four FMAs.
+matrix<float> * matmul_tall_skinny(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m2->cols <= skinny_max_dim);
+
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+  const unsigned int depth = m1->cols;
+
+  std::vector<float> packed((size_t) depth * skinny_max_dim, 0.0f);
+  for (unsigned int k = 0; k < depth; k++) {
+    for (unsigned int j = 0; j < n; j++) packed[(size_t) k * skinny_max_dim + j] = (*m2->_elements)[k][j];
+  }
+  // With eight or fewer columns the second half of every packed row is zero
+  const bool wide = n > 8;
+
+  auto bounds = skinny_partition(m1->rows, (size_t) m1->rows * depth * n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    float buf[skinny_max_dim];
+    for (unsigned int i = begin; i < end; i += 4) {
+      const unsigned int count = std::min(4u, end - i);
+      const float * rows[4];
+      for (unsigned int r = 0; r < 4; r++) rows[r] = m1->_elements->at(i + std::min(r, count - 1)).data();
+
+      __m256 lo0 = _mm256_setzero_ps(), hi0 = _mm256_setzero_ps();
+      __m256 lo1 = _mm256_setzero_ps(), hi1 = _mm256_setzero_ps();
+      __m256 lo2 = _mm256_setzero_ps(), hi2 = _mm256_setzero_ps();
+      __m256 lo3 = _mm256_setzero_ps(), hi3 = _mm256_setzero_ps();
+      for (unsigned int k = 0; k < depth; k++) {
+        const float * b = &packed[(size_t) k * skinny_max_dim];
+        __m256 b_lo = _mm256_loadu_ps(b);
+        __m256 a0 = _mm256_set1_ps(rows[0][k]);
+        __m256 a1 = _mm256_set1_ps(rows[1][k]);
+        __m256 a2 = _mm256_set1_ps(rows[2][k]);
+        __m256 a3 = _mm256_set1_ps(rows[3][k]);
+        lo0 = _mm256_fmadd_ps(a0, b_lo, lo0);
+        lo1 = _mm256_fmadd_ps(a1, b_lo, lo1);
+        lo2 = _mm256_fmadd_ps(a2, b_lo, lo2);
+        lo3 = _mm256_fmadd_ps(a3, b_lo, lo3);
+        if (wide) {
+          __m256 b_hi = _mm256_loadu_ps(b + 8);
+          hi0 = _mm256_fmadd_ps(a0, b_hi, hi0);
+          hi1 = _mm256_fmadd_ps(a1, b_hi, hi1);
+          hi2 = _mm256_fmadd_ps(a2, b_hi, hi2);
+          hi3 = _mm256_fmadd_ps(a3, b_hi, hi3);
+        }
+      }
+
+      const __m256 lo[4] = { lo0, lo1, lo2, lo3 };
+      const __m256 hi[4] = { hi0, hi1, hi2, hi3 };
+      for (unsigned int r = 0; r < count; r++) {
+        _mm256_storeu_ps(buf, epilogue_apply_ps(ep, lo[r], i + r, 0, std::min(8u, n)));
+        if (wide) _mm256_storeu_ps(buf + 8, epilogue_apply_ps(ep, hi[r], i + r, 8, n - 8));
+        for (unsigned int j = 0; j < n; j++) {
+          (*res->_elements)[i + r][j] = buf[j];
+          (*res->_elements_col_maj)[j][i + r] = buf[j];
+        }
+      }
+    }
+  }, true);
+  return res;
+}
+
+// m2 is streamed row by row in strips of eight columns.  For each strip,
+// one accumulator per row of m1 (at most sixteen, one per YMM register)
+// is built up over the whole shared dimension, so every element of m2 is
+// loaded exactly once and the result strip is stored exactly once.
+matrix<float> * matmul_short_wide(matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m1->rows <= skinny_max_dim);
+
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  const unsigned int m = m1->rows;
+  const unsigned int n = m2->cols;
+  const unsigned int depth = m1->cols;
+  const unsigned int strips = (n + 7) / 8;
+
+  auto bounds = skinny_partition(strips, (size_t) m * depth * n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    __m256 acc[skinny_max_dim];
+    float buf[8];
+    for (unsigned int s = begin; s < end; s++) {
+      const unsigned int j = s * 8;
+      const unsigned int width = std::min(8u, n - j);
+      for (unsigned int r = 0; r < m; r++) acc[r] = _mm256_setzero_ps();
+
+      for (unsigned int k = 0; k < depth; k++) {
+        const float * m2_row = m2->_elements->at(k).data() + j;
+        __m256 m2_seg;
+        if (width == 8) {
+          m2_seg = _mm256_loadu_ps(m2_row);
+        } else {
+          // Pad the last strip so it never reads past the end of the row
+          for (unsigned int w = 0; w < 8; w++) buf[w] = w < width ? m2_row[w] : 0.0f;
+          m2_seg = _mm256_loadu_ps(buf);
+        }
+        for (unsigned int r = 0; r < m; r++) {
+          acc[r] = _mm256_fmadd_ps(_mm256_set1_ps((*m1->_elements)[r][k]), m2_seg, acc[r]);
+        }
+      }
+
+      for (unsigned int r = 0; r < m; r++) {
+        _mm256_storeu_ps(buf, epilogue_apply_ps(ep, acc[r], r, j, width));
+        for (unsigned int w = 0; w < width; w++) {
+          (*res->_elements)[r][j + w] = buf[w];
+          (*res->_elements_col_maj)[j + w][r] = buf[w];
+        }
+      }
+    }
+  });
+  return res;
+}
@@ -0,0 +1,134 @@
+#ifndef SKINNY_H
+#define SKINNY_H
+
+#include <vector>
+#include <algorithm>
+#include "matrix.h"
+#include "parallel.h"
+
+// Kernels for multiplies where one side is very narrow.  When m2 has a
+// handful of columns (or m1 a handful of rows) there is almost no reuse to
+// block for; the work is bound by how fast the big operand can be streamed
+// from memory.  These kernels read the big operand exactly once, in storage
+// order, and keep the small operand and the partial results close by.
+// The epilogue is applied to the accumulators just before they are stored.
+
+// Largest narrow dimension the skinny kernels are used for
+const unsigned int skinny_max_dim = 16;
+
+// Below this many multiply-adds per thread the skinny kernels don't spawn threads
+const size_t skinny_parallel_grain = 1 << 18;
+
+// Split n equally weighted items into ranges for parallel_ranges
+inline std::vector<unsigned int> skinny_partition(unsigned int n, size_t work) {
+  size_t parts = std::min<size_t>(hardware_threads(), work / skinny_parallel_grain + 1);
+  return balanced_partition(n, [](unsigned int i) { return (size_t) i; }, parts);
+}
+
+// Matrix-vector product, m2 is a single column.  Each row of m1 is dotted
+// with the column of m2, which is contiguous in the column major copy.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_gemv(matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m2->cols == 1);
+
+  const auto res = new matrix<T>(m1->rows, 1);
+  const typename matrix<T>::row_type & x = m2->_elements_col_maj->at(0);
+
+  auto bounds = skinny_partition(m1->rows, (size_t) m1->rows * m1->cols);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++) {
+      const typename matrix<T>::row_type & m1_row = m1->_elements->at(i);
+      decltype(T() * T()) acc = 0;
+      for (unsigned int k = 0; k < m1->cols; k++) acc += m1_row[k] * x[k];
+      acc = ep.apply(acc, i, 0);
+      (*res->_elements)[i][0] = acc;
+      (*res->_elements_col_maj)[0][i] = acc;
+    }
+  }, true);
+  return res;
+}
+
+// m2 has at most skinny_max_dim columns.  A row of the result is small
+// enough to keep entirely in accumulators while the matching row of m1
+// streams past, and m2 is small enough to stay in cache.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_tall_skinny(matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m2->cols <= skinny_max_dim);
+
+  const auto res = new matrix<T>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+
+  auto bounds = skinny_partition(m1->rows, (size_t) m1->rows * m1->cols * n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    decltype(T() * T()) acc[skinny_max_dim];
+    for (unsigned int i = begin; i < end; i++) {
+      const typename matrix<T>::row_type & m1_row = m1->_elements->at(i);
+      for (unsigned int j = 0; j < n; j++) acc[j] = 0;
+      for (unsigned int k = 0; k < m1->cols; k++) {
+        const typename matrix<T>::row_type & m2_row = m2->_elements->at(k);
+        for (unsigned int j = 0; j < n; j++) acc[j] += m1_row[k] * m2_row[j];
+      }
+      for (unsigned int j = 0; j < n; j++) {
+        acc[j] = ep.apply(acc[j], i, j);
+        (*res->_elements)[i][j] = acc[j];
+        (*res->_elements_col_maj)[j][i] = acc[j];
+      }
+    }
+  }, true);
+  return res;
+}
+
+// m1 has at most skinny_max_dim rows.  Now m2 is the big operand: each of
+// its columns is read once, from the column major copy, and dotted with
+// every row of m1, which is small enough to stay in cache.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_short_wide(matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  assert(m1->rows <= skinny_max_dim);
+
+  const auto res = new matrix<T>(m1->rows, m2->cols);
+  const unsigned int m = m1->rows;
+
+  auto bounds = skinny_partition(m2->cols, (size_t) m * m1->cols * m2->cols);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    decltype(T() * T()) acc[skinny_max_dim];
+    for (unsigned int j = begin; j < end; j++) {
+      const typename matrix<T>::row_type & m2_col = m2->_elements_col_maj->at(j);
+      for (unsigned int r = 0; r < m; r++) acc[r] = 0;
+      for (unsigned int k = 0; k < m1->cols; k++) {
+        for (unsigned int r = 0; r < m; r++) acc[r] += (*m1->_elements)[r][k] * m2_col[k];
+      }
+      for (unsigned int r = 0; r < m; r++) {
+        acc[r] = ep.apply(acc[r], r, j);
+        (*res->_elements)[r][j] = acc[r];
+        (*res->_elements_col_maj)[j][r] = acc[r];
+      }
+    }
+  });
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_gemv(matrix<T> * m1, matrix<T> * m2) {
+  return matmul_gemv(m1, m2, epilogue<T>());
+}
+
+template <class T>
+matrix<T> * matmul_tall_skinny(matrix<T> * m1, matrix<T> * m2) {
+  return matmul_tall_skinny(m1, m2, epilogue<T>());
+}
+
+template <class T>
+matrix<T> * matmul_short_wide(matrix<T> * m1, matrix<T> * m2) {
+  return matmul_short_wide(m1, m2, epilogue<T>());
+}
+
+#endif //SKINNY_H
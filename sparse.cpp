@@ -0,0 +1,130 @@
+#include "sparse.h"
+
+// AVX FMA specializations of the sparse x dense kernels for float.
+// The dense dimension (the columns of m2) is processed in strips of
+// 32 floats held in four YMM accumulators.  Every nonzero in the row
+// is broadcast and fused multiply-added against the matching strip of
+// an m2 row, and the strip of the result is stored exactly once, after
+// the epilogue has been applied to the accumulator.
+
+// out[0..n) = sum over p of vals[p] * rows[idx[p]][0..n), finished by ep as row `row`
+static void csr_row_avxfma(const unsigned int * idx, const float * vals, unsigned int count,
+                           const matrix<float>::storage_type & m2_rows,
+                           float * out, unsigned int n,
+                           const epilogue<float> & ep, unsigned int row) {
+  unsigned int j = 0;
+  for (; j + 32 <= n; j += 32) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    for (unsigned int p = 0; p < count; p++) {
+      const __m256 val = _mm256_set1_ps(vals[p]);
+      const float * m2_row = m2_rows[idx[p]].data() + j;
+      acc0 = _mm256_fmadd_ps(val, _mm256_loadu_ps(m2_row), acc0);
+      acc1 = _mm256_fmadd_ps(val, _mm256_loadu_ps(m2_row + 8), acc1);
+      acc2 = _mm256_fmadd_ps(val, _mm256_loadu_ps(m2_row + 16), acc2);
+      acc3 = _mm256_fmadd_ps(val, _mm256_loadu_ps(m2_row + 24), acc3);
+    }
+    _mm256_storeu_ps(out + j, epilogue_apply_ps(ep, acc0, row, j, 8));
+    _mm256_storeu_ps(out + j + 8, epilogue_apply_ps(ep, acc1, row, j + 8, 8));
+    _mm256_storeu_ps(out + j + 16, epilogue_apply_ps(ep, acc2, row, j + 16, 8));
+    _mm256_storeu_ps(out + j + 24, epilogue_apply_ps(ep, acc3, row, j + 24, 8));
+  }
+  for (; j + 8 <= n; j += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (unsigned int p = 0; p < count; p++) {
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(vals[p]), _mm256_loadu_ps(m2_rows[idx[p]].data() + j), acc);
+    }
+    _mm256_storeu_ps(out + j, epilogue_apply_ps(ep, acc, row, j, 8));
+  }
+  for (; j < n; j++) {
+    float acc = 0;
+    for (unsigned int p = 0; p < count; p++) {
+      acc += vals[p] * m2_rows[idx[p]][j];
+    }
+    out[j] = ep.apply(acc, row, j);
+  }
+}
+
+matrix<float> * matmul_csr(const csr_matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+
+  auto bounds = sparse_row_partition(m1->row_ptr, 1, n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++) {
+      unsigned int first = m1->row_ptr[i];
+      float * res_row = res->_elements->at(i).data();
+      csr_row_avxfma(m1->col_idx.data() + first, m1->values.data() + first, m1->row_ptr[i + 1] - first,
+                     *m2->_elements, res_row, n, ep, i);
+      // Each thread owns distinct rows, so the column major writes don't overlap
+      for (unsigned int j = 0; j < n; j++) (*res->_elements_col_maj)[j][i] = res_row[j];
+    }
+  }, true);
+  return res;
+}
+
+// For a block row, every 8 wide strip of the result is accumulated for all
+// rows of the block at once, so each strip of an m2 row is loaded once per
+// block and reused for every row of the block.
+matrix<float> * matmul_bsr(const bsr_matrix<float> * m1, matrix<float> * m2, const epilogue<float> & ep) {
+  // The accumulators live on the stack; very large blocks use the generic path
+  const unsigned int max_block = 16;
+  if (m1->block_size > max_block) return matmul_bsr<float>(m1, m2, ep);
+
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+  const unsigned int bs = m1->block_size;
+
+  auto bounds = sparse_row_partition(m1->block_ptr, bs * bs, n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    __m256 acc[max_block];
+    float buf[8];
+    for (unsigned int bi = begin; bi < end; bi++) {
+      unsigned int row_count = std::min(bs, m1->rows - bi * bs);
+      for (unsigned int j = 0; j < n; j += 8) {
+        unsigned int width = std::min(8u, n - j);
+        for (unsigned int r = 0; r < row_count; r++) acc[r] = _mm256_setzero_ps();
+
+        for (unsigned int p = m1->block_ptr[bi]; p < m1->block_ptr[bi + 1]; p++) {
+          const float * block = &m1->values[(size_t) p * bs * bs];
+          unsigned int k0 = m1->block_col[p] * bs;
+          unsigned int k_count = std::min(bs, m1->cols - k0);
+          for (unsigned int c = 0; c < k_count; c++) {
+            const float * m2_row = m2->_elements->at(k0 + c).data() + j;
+            __m256 m2_seg;
+            if (width == 8) {
+              m2_seg = _mm256_loadu_ps(m2_row);
+            } else {
+              // Pad the last strip so it never reads past the end of the row
+              for (unsigned int w = 0; w < 8; w++) buf[w] = w < width ? m2_row[w] : 0.0f;
+              m2_seg = _mm256_loadu_ps(buf);
+            }
+            for (unsigned int r = 0; r < row_count; r++) {
+              acc[r] = _mm256_fmadd_ps(_mm256_set1_ps(block[r * bs + c]), m2_seg, acc[r]);
+            }
+          }
+        }
+
+        for (unsigned int r = 0; r < row_count; r++) {
+          unsigned int i = bi * bs + r;
+          _mm256_storeu_ps(buf, epilogue_apply_ps(ep, acc[r], i, j, width));
+          for (unsigned int w = 0; w < width; w++) {
+            (*res->_elements)[i][j + w] = buf[w];
+            (*res->_elements_col_maj)[j + w][i] = buf[w];
+          }
+        }
+      }
+    }
+  }, true);
+  return res;
+}
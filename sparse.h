@@ -0,0 +1,256 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <vector>
+#include <algorithm>
+#include "matrix.h"
+#include "parallel.h"
+
+// Left hand operands that are mostly zero are cheaper to multiply in a
+// compressed form: only the nonzeros are stored and the kernels never touch
+// the zeros.  Both formats here are built from a dense matrix<T> and are
+// multiplied against a dense right hand side, producing a dense result.
+
+// At or below this fraction of nonzeros, matmul() converts the left hand
+// operand to CSR instead of running a dense kernel.
+const double sparse_density_threshold = 0.10;
+
+// Below this many multiply-adds per thread, spawning threads costs more
+// than it saves and the sparse kernels stay on the calling thread.
+const size_t sparse_parallel_grain = 1 << 16;
+
+// Compressed Sparse Row.  The nonzeros of row i are values[row_ptr[i]] to
+// values[row_ptr[i + 1] - 1], and col_idx holds the column of each one.
+template <class T>
+class csr_matrix {
+
+  public:
+    unsigned int rows;
+    unsigned int cols;
+
+    std::vector<unsigned int> row_ptr;
+    std::vector<unsigned int> col_idx;
+    std::vector<T> values;
+
+    csr_matrix(const matrix<T> * m);
+
+    size_t nnz() const { return values.size(); }
+};
+
+template <class T>
+csr_matrix<T>::csr_matrix(const matrix<T> * m) {
+  this->rows = m->rows;
+  this->cols = m->cols;
+  row_ptr.resize(rows + 1);
+  row_ptr[0] = 0;
+  for (unsigned int i = 0; i < rows; i++) {
+    for (unsigned int j = 0; j < cols; j++) {
+      T val = m->get(i, j);
+      if (val != T(0)) {
+        col_idx.push_back(j);
+        values.push_back(val);
+      }
+    }
+    row_ptr[i + 1] = values.size();
+  }
+}
+
+// Block Sparse Row.  The matrix is tiled into block_size x block_size
+// blocks and only blocks with at least one nonzero are stored, densely and
+// row major, block_size * block_size values each.  Block row I covers rows
+// I * block_size onwards; its blocks are block_ptr[I] to block_ptr[I + 1] - 1
+// and block_col holds the block column of each.  Edge blocks are zero padded.
+// With block_size equal to the SIMD width a block row maps onto a full set
+// of accumulator registers.
+template <class T>
+class bsr_matrix {
+
+  public:
+    unsigned int rows;
+    unsigned int cols;
+    unsigned int block_size;
+    unsigned int block_rows;
+    unsigned int block_cols;
+
+    std::vector<unsigned int> block_ptr;
+    std::vector<unsigned int> block_col;
+    std::vector<T> values;
+
+    bsr_matrix(const matrix<T> * m, unsigned int block_size = 8);
+
+    size_t nnz_blocks() const { return block_col.size(); }
+};
+
+template <class T>
+bsr_matrix<T>::bsr_matrix(const matrix<T> * m, unsigned int block_size) {
+  assert(block_size > 0);
+  this->rows = m->rows;
+  this->cols = m->cols;
+  this->block_size = block_size;
+  this->block_rows = (rows + block_size - 1) / block_size;
+  this->block_cols = (cols + block_size - 1) / block_size;
+
+  block_ptr.resize(block_rows + 1);
+  block_ptr[0] = 0;
+  std::vector<T> block(block_size * block_size);
+  for (unsigned int bi = 0; bi < block_rows; bi++) {
+    for (unsigned int bj = 0; bj < block_cols; bj++) {
+      bool nonzero = false;
+      for (unsigned int r = 0; r < block_size; r++) {
+        for (unsigned int c = 0; c < block_size; c++) {
+          unsigned int i = bi * block_size + r;
+          unsigned int j = bj * block_size + c;
+          T val = (i < rows && j < cols) ? m->get(i, j) : T(0);
+          if (val != T(0)) nonzero = true;
+          block[r * block_size + c] = val;
+        }
+      }
+      if (nonzero) {
+        block_col.push_back(bj);
+        values.insert(values.end(), block.begin(), block.end());
+      }
+    }
+    block_ptr[bi + 1] = block_col.size();
+  }
+}
+
+// Fraction of the elements of m that are nonzero
+template <class T>
+double density(const matrix<T> * m) {
+  size_t nnz = 0;
+  for (unsigned int i = 0; i < m->rows; i++) {
+    for (unsigned int j = 0; j < m->cols; j++) {
+      if (m->get(i, j) != T(0)) nnz++;
+    }
+  }
+  return m->rows * m->cols == 0 ? 0.0 : (double) nnz / ((double) m->rows * m->cols);
+}
+
+// Whether at most the given fraction of the elements of m are nonzero.
+// Stops as soon as the count passes the limit, so a dense matrix costs a
+// pass over about that fraction of it rather than all of it.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+bool density_at_most(const matrix<T> * m, double fraction) {
+  const size_t limit = (size_t) (fraction * ((double) m->rows * m->cols));
+  size_t nnz = 0;
+  for (unsigned int i = 0; i < m->rows; i++) {
+    const T * row = (*m->_elements)[i].data();
+    for (unsigned int j = 0; j < m->cols; j++) {
+      if (row[j] != T(0) && ++nnz > limit) return false;
+    }
+  }
+  return true;
+}
+
+// Split the rows of a sparse operand across threads so each thread gets
+// about the same number of nonzeros, not the same number of rows.
+// ptr is the row (or block row) pointer array, and each nonzero costs
+// dense_cols multiply-adds.  Every row also costs one store of the result.
+inline std::vector<unsigned int> sparse_row_partition(const std::vector<unsigned int> & ptr,
+                                                      unsigned int nnz_per_entry,
+                                                      unsigned int dense_cols) {
+  unsigned int n = ptr.size() - 1;
+  size_t work = ((size_t) ptr[n] * nnz_per_entry + n) * dense_cols;
+  size_t parts = std::min<size_t>(hardware_threads(), work / sparse_parallel_grain + 1);
+  return balanced_partition(n, [&](unsigned int i) {
+    return (size_t) ptr[i] * nnz_per_entry + i;
+  }, parts);
+}
+
+// Multiply a CSR matrix by a dense matrix.  Row i of the result is the sum
+// of the rows of m2 picked out by the nonzeros of row i, so the inner loop
+// runs along a row of m2 and an accumulator row, which is what vectorizes.
+// The epilogue is applied to each accumulator as the row is stored.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_csr(const csr_matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<T>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+
+  auto bounds = sparse_row_partition(m1->row_ptr, 1, n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    std::vector<decltype(T() * T())> acc(n);
+    for (unsigned int i = begin; i < end; i++) {
+      std::fill(acc.begin(), acc.end(), 0);
+      for (unsigned int p = m1->row_ptr[i]; p < m1->row_ptr[i + 1]; p++) {
+        const T val = m1->values[p];
+        const typename matrix<T>::row_type & m2_row = m2->_elements->at(m1->col_idx[p]);
+        for (unsigned int j = 0; j < n; j++) {
+          acc[j] += val * m2_row[j];
+        }
+      }
+      // Each thread owns distinct rows, so the column major writes don't overlap
+      for (unsigned int j = 0; j < n; j++) {
+        const T out = ep.apply(acc[j], i, j);
+        (*res->_elements)[i][j] = out;
+        (*res->_elements_col_maj)[j][i] = out;
+      }
+    }
+  }, true);
+  return res;
+}
+
+// Multiply a BSR matrix by a dense matrix, one block row at a time, into
+// accumulators for the rows of the block that the epilogue is applied to
+// as they are stored.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_bsr(const bsr_matrix<T> * m1, matrix<T> * m2, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+
+  // An MxN * NxP yields an MxP matrix
+  const auto res = new matrix<T>(m1->rows, m2->cols);
+  const unsigned int n = m2->cols;
+  const unsigned int bs = m1->block_size;
+
+  auto bounds = sparse_row_partition(m1->block_ptr, bs * bs, n);
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    std::vector<decltype(T() * T())> acc((size_t) bs * n);
+    for (unsigned int bi = begin; bi < end; bi++) {
+      unsigned int row_count = std::min(bs, m1->rows - bi * bs);
+      std::fill(acc.begin(), acc.end(), 0);
+      for (unsigned int p = m1->block_ptr[bi]; p < m1->block_ptr[bi + 1]; p++) {
+        const T * block = &m1->values[(size_t) p * bs * bs];
+        unsigned int k0 = m1->block_col[p] * bs;
+        unsigned int k_count = std::min(bs, m1->cols - k0);
+        for (unsigned int r = 0; r < row_count; r++) {
+          auto * acc_row = &acc[(size_t) r * n];
+          for (unsigned int c = 0; c < k_count; c++) {
+            const T val = block[r * bs + c];
+            const typename matrix<T>::row_type & m2_row = m2->_elements->at(k0 + c);
+            for (unsigned int j = 0; j < n; j++) {
+              acc_row[j] += val * m2_row[j];
+            }
+          }
+        }
+      }
+      for (unsigned int r = 0; r < row_count; r++) {
+        unsigned int i = bi * bs + r;
+        for (unsigned int j = 0; j < n; j++) {
+          const T out = ep.apply(acc[(size_t) r * n + j], i, j);
+          (*res->_elements)[i][j] = out;
+          (*res->_elements_col_maj)[j][i] = out;
+        }
+      }
+    }
+  }, true);
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_csr(const csr_matrix<T> * m1, matrix<T> * m2) {
+  return matmul_csr(m1, m2, epilogue<T>());
+}
+
+template <class T>
+matrix<T> * matmul_bsr(const bsr_matrix<T> * m1, matrix<T> * m2) {
+  return matmul_bsr(m1, m2, epilogue<T>());
+}
+
+#endif //SPARSE_H
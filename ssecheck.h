@@ -8,4 +8,12 @@ int avx_enabled() {
 
 int avx2_enabled() {
 	return __builtin_cpu_supports("avx2") > 0 ? 1 : 0;
+}
+
+int f16c_enabled() {
+	return __builtin_cpu_supports("f16c") > 0 ? 1 : 0;
+}
+
+int avx512bf16_enabled() {
+	return __builtin_cpu_supports("avx512bf16") > 0 ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "transport.h"
+
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <new>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+const char * transport_name(transport_kind kind) {
+  switch (kind) {
+    case transport_kind::shared_memory: return "shared memory";
+    case transport_kind::unix_socket: return "unix sockets";
+    case transport_kind::tcp_socket: return "tcp sockets";
+  }
+  return "unknown";
+}
+
+// Report a failed setup call on stderr; always false
+static bool setup_failed(const char * call) {
+  std::cerr << "make_transport: " << call << " failed: " << std::strerror(errno) << std::endl;
+  return false;
+}
+
+// Bytes a shared memory mailbox carries per hand off
+const size_t shm_slot_bytes = 256 * 1024;
+
+// One mailbox per ordered pair of endpoints, each a single slot that the
+// sender fills and the receiver drains.  Messages longer than a slot are
+// passed through it a slot at a time.  The mapping is shared with every
+// forked process, and only the pages of mailboxes actually used are touched.
+// A flag at its start tells every process that the transport was aborted.
+class shm_transport : public transport {
+
+  public:
+    explicit shm_transport(unsigned int endpoints) : transport(endpoints), _header(nullptr), _boxes(nullptr),
+        _ready_boxes(0), _creator(getpid()), _ok(false) {
+      _bytes = sizeof(header) + sizeof(mailbox) * endpoints * endpoints;
+      void * p = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        setup_failed("mmap");
+        return;
+      }
+      _header = new (p) header;
+      _boxes = (mailbox *) ((char *) p + sizeof(header));
+      for (; _ready_boxes < endpoints * endpoints; _ready_boxes++) {
+        mailbox & box = _boxes[_ready_boxes];
+        if (sem_init(&box.empty, 1, 1) != 0) {
+          setup_failed("sem_init");
+          return;
+        }
+        if (sem_init(&box.full, 1, 0) != 0) {
+          setup_failed("sem_init");
+          sem_destroy(&box.empty);
+          return;
+        }
+      }
+      _ok = true;
+    }
+
+    ~shm_transport() {
+      if (_header == nullptr) return;
+      // Only the process that created the semaphores destroys them
+      if (getpid() == _creator) {
+        for (unsigned int b = 0; b < _ready_boxes; b++) {
+          sem_destroy(&_boxes[b].empty);
+          sem_destroy(&_boxes[b].full);
+        }
+      }
+      munmap(_header, _bytes);
+    }
+
+    // Whether the constructor set everything up
+    bool ok() const { return _ok; }
+
+    bool send(unsigned int to, const void * data, size_t bytes) override {
+      mailbox & box = _boxes[rank() * size() + to];
+      const char * src = (const char *) data;
+      do {
+        const size_t chunk = std::min(bytes, shm_slot_bytes);
+        if (!_wait(&box.empty)) return false;
+        std::memcpy(box.data, src, chunk);
+        box.bytes = chunk;
+        sem_post(&box.full);
+        src += chunk;
+        bytes -= chunk;
+      } while (bytes > 0);
+      return true;
+    }
+
+    bool recv(unsigned int from, void * data, size_t bytes) override {
+      mailbox & box = _boxes[from * size() + rank()];
+      char * dest = (char *) data;
+      do {
+        if (!_wait(&box.full)) return false;
+        if (box.bytes > bytes) {
+          // The ranks disagree on the order of their exchanges
+          abort();
+          return false;
+        }
+        std::memcpy(dest, box.data, box.bytes);
+        dest += box.bytes;
+        bytes -= box.bytes;
+        sem_post(&box.empty);
+      } while (bytes > 0);
+      return true;
+    }
+
+    void abort() override {
+      _header->aborted = true;
+    }
+
+  private:
+    struct alignas(64) header {
+      std::atomic<bool> aborted;
+      header() : aborted(false) {}
+    };
+
+    struct mailbox {
+      sem_t empty;
+      sem_t full;
+      size_t bytes;
+      char data[shm_slot_bytes];
+    };
+
+    // Take sem, checking on the peers every transport_poll_ms
+    bool _wait(sem_t * sem) {
+      for (;;) {
+        if (_header->aborted) return false;
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += transport_poll_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if (sem_timedwait(sem, &deadline) == 0) return true;
+        // Otherwise interrupted by a signal (retry) or timed out
+        if (errno == ETIMEDOUT && !alive()) {
+          abort();
+          return false;
+        }
+      }
+    }
+
+    header * _header;
+    mailbox * _boxes;
+    // Mailboxes whose semaphores were initialized
+    unsigned int _ready_boxes;
+    size_t _bytes;
+    pid_t _creator;
+    bool _ok;
+};
+
+// A connected loopback TCP pair, made by connecting to a listener and
+// accepting the connection in the same process.  On failure nothing is
+// left open and false is returned.
+static bool tcp_socketpair(int listener, const sockaddr_in & addr, int fds[2]) {
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  if (fds[0] < 0) return setup_failed("socket");
+  if (connect(fds[0], (const sockaddr *) &addr, sizeof(addr)) != 0) {
+    setup_failed("connect");
+    close(fds[0]);
+    return false;
+  }
+  fds[1] = accept(listener, nullptr, nullptr);
+  if (fds[1] < 0) {
+    setup_failed("accept");
+    close(fds[0]);
+    return false;
+  }
+  // Panels are sent whole; don't hold back the tail of one
+  const int one = 1;
+  setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+// Every pair of endpoints gets its own connected stream socket pair;
+// _fds[i][j] is the end endpoint i uses to talk to endpoint j.
+class socket_transport : public transport {
+
+  public:
+    socket_transport(unsigned int endpoints, bool tcp) : transport(endpoints), _attached(false),
+        _fds(endpoints, std::vector<int>(endpoints, -1)) {
+      int listener = -1;
+      sockaddr_in addr;
+      if (tcp) {
+        listener = _listen(&addr);
+        _ok = listener >= 0;
+      } else {
+        _ok = true;
+      }
+      // The ends made so far are closed by the destructor
+      for (unsigned int i = 0; i < endpoints && _ok; i++) {
+        for (unsigned int j = i + 1; j < endpoints && _ok; j++) {
+          int fds[2];
+          if (tcp) {
+            _ok = tcp_socketpair(listener, addr, fds);
+          } else if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            _ok = setup_failed("socketpair");
+          }
+          if (_ok) {
+            _fds[i][j] = fds[0];
+            _fds[j][i] = fds[1];
+          }
+        }
+      }
+      if (listener >= 0) close(listener);
+    }
+
+    ~socket_transport() {
+      for (unsigned int i = 0; i < size(); i++) {
+        if (_attached && i != rank()) continue;
+        for (int fd : _fds[i]) {
+          if (fd >= 0) close(fd);
+        }
+      }
+    }
+
+    // Keep only this rank's ends, so a peer that exits is seen as end of file
+    // Whether the constructor set everything up
+    bool ok() const { return _ok; }
+
+    void attach(unsigned int rank) override {
+      transport::attach(rank);
+      _attached = true;
+      for (unsigned int i = 0; i < size(); i++) {
+        if (i == rank) continue;
+        for (int & fd : _fds[i]) {
+          if (fd >= 0) close(fd);
+          fd = -1;
+        }
+      }
+    }
+
+    bool send(unsigned int to, const void * data, size_t bytes) override {
+      const int fd = _fds[rank()][to];
+      const char * src = (const char *) data;
+      while (bytes > 0) {
+        if (!_ready(fd, POLLOUT)) return false;
+        ssize_t n = ::send(fd, src, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        // EPIPE and the like: the peer is gone
+        if (n <= 0) return false;
+        src += n;
+        bytes -= n;
+      }
+      return true;
+    }
+
+    bool recv(unsigned int from, void * data, size_t bytes) override {
+      const int fd = _fds[rank()][from];
+      char * dest = (char *) data;
+      while (bytes > 0) {
+        if (!_ready(fd, POLLIN)) return false;
+        ssize_t n = ::recv(fd, dest, bytes, 0);
+        if (n < 0 && errno == EINTR) continue;
+        // End of file means the peer exited early
+        if (n <= 0) return false;
+        dest += n;
+        bytes -= n;
+      }
+      return true;
+    }
+
+    // Shutting down every end this process holds makes its peers see end
+    // of file, so they fail (and abort their own ends) in turn
+    void abort() override {
+      for (auto & row : _fds) {
+        for (int fd : row) {
+          if (fd >= 0) shutdown(fd, SHUT_RDWR);
+        }
+      }
+    }
+
+  private:
+    // A loopback listener on a port of the kernel's choosing, whose address
+    // goes in addr; -1 on failure
+    static int _listen(sockaddr_in * addr) {
+      const int listener = socket(AF_INET, SOCK_STREAM, 0);
+      if (listener < 0) {
+        setup_failed("socket");
+        return -1;
+      }
+      std::memset(addr, 0, sizeof(*addr));
+      addr->sin_family = AF_INET;
+      addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr->sin_port = 0;
+      socklen_t len = sizeof(*addr);
+      const char * failed = nullptr;
+      if (bind(listener, (const sockaddr *) addr, sizeof(*addr)) != 0) {
+        failed = "bind";
+      } else if (listen(listener, 16) != 0) {
+        failed = "listen";
+      } else if (getsockname(listener, (sockaddr *) addr, &len) != 0) {
+        failed = "getsockname";
+      }
+      if (failed == nullptr) return listener;
+      setup_failed(failed);
+      close(listener);
+      return -1;
+    }
+
+    // Wait until fd is ready for events (or has failed, which the following
+    // call reports), checking on the peers every transport_poll_ms
+    bool _ready(int fd, short events) {
+      for (;;) {
+        pollfd pfd = { fd, events, 0 };
+        const int rc = poll(&pfd, 1, transport_poll_ms);
+        if (rc > 0) return true;
+        if (rc < 0 && errno != EINTR) return false;
+        if (rc == 0 && !alive()) {
+          abort();
+          return false;
+        }
+      }
+    }
+
+    bool _attached;
+    bool _ok;
+    std::vector<std::vector<int>> _fds;
+};
+
+// t, or null (having closed it) if its constructor reported a failure
+template <class T>
+static std::unique_ptr<transport> checked(T * t) {
+  std::unique_ptr<T> owned(t);
+  if (!owned->ok()) return nullptr;
+  return owned;
+}
+
+std::unique_ptr<transport> make_transport(transport_kind kind, unsigned int endpoints) {
+  switch (kind) {
+    case transport_kind::shared_memory: return checked(new shm_transport(endpoints));
+    case transport_kind::unix_socket: return checked(new socket_transport(endpoints, false));
+    case transport_kind::tcp_socket: return checked(new socket_transport(endpoints, true));
+  }
+  return nullptr;
+}
@@ -0,0 +1,68 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstddef>
+#include <memory>
+#include <functional>
+
+// Point to point byte transport between the processes of a distributed
+// multiply (see distributed.h).  Endpoints are numbered 0 .. size() - 1.
+//
+// A transport is created in one process before it forks; every process,
+// parent included, then calls attach() with its own rank once the forking
+// is done, which releases what belongs to the other ranks.  Messages between
+// a pair of ranks arrive in the order they were sent.  send() may block
+// until the receiver has taken (part of) the message, so the processes must
+// agree on the order of their exchanges.  Within one process, only one
+// thread may use the transport at a time.
+//
+// send() and recv() return false instead of blocking for good when a peer
+// has gone away or the transport was aborted.  While they wait, they call
+// the function given to watch() every transport_poll_ms; when it returns
+// false (e.g. a worker process died) the transport is aborted, which makes
+// the pending and all later calls fail in every process.
+class transport {
+
+  public:
+    explicit transport(unsigned int endpoints) : _size(endpoints), _rank(0), _alive([]() { return true; }) {}
+    virtual ~transport() {}
+
+    virtual void attach(unsigned int rank) { _rank = rank; }
+    virtual bool send(unsigned int to, const void * data, size_t bytes) = 0;
+    virtual bool recv(unsigned int from, void * data, size_t bytes) = 0;
+    virtual void abort() = 0;
+
+    void watch(std::function<bool()> alive) { _alive = std::move(alive); }
+
+    unsigned int rank() const { return _rank; }
+    unsigned int size() const { return _size; }
+
+  protected:
+    bool alive() const { return _alive(); }
+
+  private:
+    unsigned int _size;
+    unsigned int _rank;
+    std::function<bool()> _alive;
+};
+
+// How often a waiting send() or recv() checks on its peers
+const int transport_poll_ms = 100;
+
+enum class transport_kind {
+  // Mailboxes in a shared anonymous mapping, guarded by process shared semaphores
+  shared_memory,
+  // A full mesh of AF_UNIX stream socket pairs
+  unix_socket,
+  // A full mesh of TCP connections over the loopback interface
+  tcp_socket
+};
+
+const char * transport_name(transport_kind kind);
+
+// Transport between endpoints processes, to be created before forking.
+// Null, with the failed system call reported on stderr, if it can't be set
+// up (e.g. out of file descriptors or shared memory).
+std::unique_ptr<transport> make_transport(transport_kind kind, unsigned int endpoints);
+
+#endif //TRANSPORT_H
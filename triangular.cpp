@@ -0,0 +1,157 @@
+#include "triangular.h"
+
+// AVX FMA specializations of the triangular kernels for float.  Both work
+// on 4 x 4 tiles of the result: four vectors on the left (rows of m1, or
+// of a) against four on the right (columns of m2, or rows of a again), so
+// each step of the shared dimension loads eight vectors for sixteen FMAs.
+
+// Sums of a, b, c and d, in that order
+static __m128 hsum4_ps(__m256 a, __m256 b, __m256 c, __m256 d) {
+  const __m256 ab = _mm256_hadd_ps(a, b);
+  const __m256 cd = _mm256_hadd_ps(c, d);
+  const __m256 abcd = _mm256_hadd_ps(ab, cd);
+  return _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1));
+}
+
+// out[r * 4 + c] = dot(a[r][k0..k1), b[c][k0..k1)) for the 4 x 4 tile
+static void dot_tile_4x4(const float * const * a, const float * const * b,
+                         unsigned int k0, unsigned int k1, float * out) {
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c02 = _mm256_setzero_ps(), c03 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps(), c12 = _mm256_setzero_ps(), c13 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c22 = _mm256_setzero_ps(), c23 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps(), c32 = _mm256_setzero_ps(), c33 = _mm256_setzero_ps();
+  unsigned int k = k0;
+  for (; k + 8 <= k1; k += 8) {
+    const __m256 b0 = _mm256_loadu_ps(b[0] + k);
+    const __m256 b1 = _mm256_loadu_ps(b[1] + k);
+    const __m256 b2 = _mm256_loadu_ps(b[2] + k);
+    const __m256 b3 = _mm256_loadu_ps(b[3] + k);
+    __m256 a_seg = _mm256_loadu_ps(a[0] + k);
+    c00 = _mm256_fmadd_ps(a_seg, b0, c00);
+    c01 = _mm256_fmadd_ps(a_seg, b1, c01);
+    c02 = _mm256_fmadd_ps(a_seg, b2, c02);
+    c03 = _mm256_fmadd_ps(a_seg, b3, c03);
+    a_seg = _mm256_loadu_ps(a[1] + k);
+    c10 = _mm256_fmadd_ps(a_seg, b0, c10);
+    c11 = _mm256_fmadd_ps(a_seg, b1, c11);
+    c12 = _mm256_fmadd_ps(a_seg, b2, c12);
+    c13 = _mm256_fmadd_ps(a_seg, b3, c13);
+    a_seg = _mm256_loadu_ps(a[2] + k);
+    c20 = _mm256_fmadd_ps(a_seg, b0, c20);
+    c21 = _mm256_fmadd_ps(a_seg, b1, c21);
+    c22 = _mm256_fmadd_ps(a_seg, b2, c22);
+    c23 = _mm256_fmadd_ps(a_seg, b3, c23);
+    a_seg = _mm256_loadu_ps(a[3] + k);
+    c30 = _mm256_fmadd_ps(a_seg, b0, c30);
+    c31 = _mm256_fmadd_ps(a_seg, b1, c31);
+    c32 = _mm256_fmadd_ps(a_seg, b2, c32);
+    c33 = _mm256_fmadd_ps(a_seg, b3, c33);
+  }
+  _mm_storeu_ps(out, hsum4_ps(c00, c01, c02, c03));
+  _mm_storeu_ps(out + 4, hsum4_ps(c10, c11, c12, c13));
+  _mm_storeu_ps(out + 8, hsum4_ps(c20, c21, c22, c23));
+  _mm_storeu_ps(out + 12, hsum4_ps(c30, c31, c32, c33));
+  for (; k < k1; k++) {
+    for (unsigned int r = 0; r < 4; r++) {
+      for (unsigned int c = 0; c < 4; c++) out[r * 4 + c] += a[r][k] * b[c][k];
+    }
+  }
+}
+
+matrix<float> * matmul_syrk(matrix<float> * a, bool trans, const epilogue<float> & ep) {
+  const matrix<float>::storage_type * vecs = trans ? a->_elements_col_maj : a->_elements;
+  const unsigned int n = vecs->size();
+  const unsigned int depth = trans ? a->rows : a->cols;
+
+  const auto res = new matrix<float>(n, n);
+  auto bounds = triangular_partition(n, 4, [depth](unsigned int i) { return (size_t) (i + 1) * depth; });
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    float out[16];
+    for (unsigned int i = begin; i < end; i += 4) {
+      // Short edge tiles repeat their last vector; the extra results are dropped
+      const unsigned int rows = std::min(4u, end - i);
+      const float * left[4];
+      for (unsigned int r = 0; r < 4; r++) left[r] = (*vecs)[i + std::min(r, rows - 1)].data();
+
+      // Tiles left of and on the diagonal; the diagonal tile is computed whole
+      for (unsigned int j = 0; j <= i; j += 4) {
+        const unsigned int cols = std::min(4u, n - j);
+        const float * right[4];
+        for (unsigned int c = 0; c < 4; c++) right[c] = (*vecs)[j + std::min(c, cols - 1)].data();
+        dot_tile_4x4(left, right, 0, depth, out);
+
+        for (unsigned int r = 0; r < rows; r++) {
+          for (unsigned int c = 0; c < cols && j + c <= i + r; c++) {
+            const float lower = ep.apply(out[r * 4 + c], i + r, j + c);
+            const float upper = ep.apply(out[r * 4 + c], j + c, i + r);
+            (*res->_elements)[i + r][j + c] = lower;
+            (*res->_elements_col_maj)[j + c][i + r] = lower;
+            (*res->_elements)[j + c][i + r] = upper;
+            (*res->_elements_col_maj)[i + r][j + c] = upper;
+          }
+        }
+      }
+    }
+  }, true);
+  return res;
+}
+
+// Each tile runs the SIMD dot products over the indices all sixteen of its
+// elements share, then adds the few (at most three per element) that only
+// some of them have.
+matrix<float> * matmul_trmm(matrix<float> * m1, matrix<float> * m2, tri_side side, triangle uplo,
+                            const epilogue<float> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  const unsigned int n = m1->cols;
+  assert(side == tri_side::left ? m1->rows == n : m2->cols == n);
+
+  const auto res = new matrix<float>(m1->rows, m2->cols);
+  auto bounds = triangular_partition(m1->rows, 4, [&](unsigned int i) {
+    if (side == tri_side::right) return (size_t) m2->cols * (n + 1) / 2;
+    unsigned int k0, k1;
+    trmm_range(side, uplo, i, 0, n, &k0, &k1);
+    return (size_t) (k1 - k0) * m2->cols;
+  });
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    float out[16];
+    for (unsigned int i = begin; i < end; i += 4) {
+      const unsigned int rows = std::min(4u, end - i);
+      const float * left[4];
+      for (unsigned int r = 0; r < 4; r++) left[r] = (*m1->_elements)[i + std::min(r, rows - 1)].data();
+
+      for (unsigned int j = 0; j < m2->cols; j += 4) {
+        const unsigned int cols = std::min(4u, m2->cols - j);
+        const float * right[4];
+        for (unsigned int c = 0; c < 4; c++) right[c] = (*m2->_elements_col_maj)[j + std::min(c, cols - 1)].data();
+
+        // Indices every element of the tile (including repeated edges) uses
+        unsigned int lo = 0, hi = n;
+        for (unsigned int r = 0; r < 4; r++) {
+          for (unsigned int c = 0; c < 4; c++) {
+            unsigned int k0, k1;
+            trmm_range(side, uplo, i + std::min(r, rows - 1), j + std::min(c, cols - 1), n, &k0, &k1);
+            lo = std::max(lo, k0);
+            hi = std::min(hi, k1);
+          }
+        }
+        if (hi < lo) hi = lo;
+        dot_tile_4x4(left, right, lo, hi, out);
+
+        for (unsigned int r = 0; r < rows; r++) {
+          for (unsigned int c = 0; c < cols; c++) {
+            unsigned int k0, k1;
+            trmm_range(side, uplo, i + r, j + c, n, &k0, &k1);
+            float acc = out[r * 4 + c];
+            for (unsigned int k = k0; k < std::min(lo, k1); k++) acc += left[r][k] * right[c][k];
+            for (unsigned int k = std::max(hi, k0); k < k1; k++) acc += left[r][k] * right[c][k];
+            acc = ep.apply(acc, i + r, j + c);
+            (*res->_elements)[i + r][j + c] = acc;
+            (*res->_elements_col_maj)[j + c][i + r] = acc;
+          }
+        }
+      }
+    }
+  }, true);
+  return res;
+}
@@ -0,0 +1,139 @@
+#ifndef TRIANGULAR_H
+#define TRIANGULAR_H
+
+#include <vector>
+#include <algorithm>
+#include "matrix.h"
+#include "parallel.h"
+
+// Kernels that skip work a general multiply would waste on structure:
+//
+//  - SYRK: the Gram matrix a * a' is symmetric, so only the lower triangle
+//    (j <= i) is computed and every value is mirrored across the diagonal.
+//    Element (i, j) is the dot product of rows i and j of a, both contiguous
+//    in the row major copy (for a' * a, columns of a in the column major
+//    copy), so no transpose is ever built.
+//  - TRMM: one operand is square and triangular.  Each dot product only
+//    runs over the shared indices where the triangular operand can be
+//    nonzero; its other triangle is never read and may hold anything.
+//
+// Both do about half the multiply-adds of the general kernels.  The rows of
+// the result are split across threads by their actual (triangular) work.
+// The epilogue is applied to every element, so row and column biases land
+// correctly on both halves of a SYRK result.
+
+enum class triangle { lower, upper };
+// Which operand of the product is the triangular one
+enum class tri_side { left, right };
+
+// Below this many multiply-adds per thread the triangular kernels don't spawn threads
+const size_t triangular_parallel_grain = 1 << 18;
+
+// Split rows [0, n), taken tile at a time, into ranges for parallel_ranges
+// of roughly equal work, where row_work(i) is the work of row i
+template <class W>
+std::vector<unsigned int> triangular_partition(unsigned int n, unsigned int tile, W row_work) {
+  const unsigned int tiles = (n + tile - 1) / tile;
+  std::vector<size_t> prefix(tiles + 1, 0);
+  for (unsigned int t = 0; t < tiles; t++) {
+    size_t work = 0;
+    for (unsigned int i = t * tile; i < std::min(n, (t + 1) * tile); i++) work += row_work(i);
+    prefix[t + 1] = prefix[t] + work;
+  }
+  size_t parts = std::min<size_t>(hardware_threads(), prefix[tiles] / triangular_parallel_grain + 1);
+  auto bounds = balanced_partition(tiles, [&prefix](unsigned int t) { return prefix[t]; }, parts);
+  for (auto & b : bounds) b = std::min(n, b * tile);
+  return bounds;
+}
+
+// Shared indices [*k0, *k1) where the triangular operand of an n x n TRMM
+// can be nonzero for result element (i, j)
+inline void trmm_range(tri_side side, triangle uplo, unsigned int i, unsigned int j, unsigned int n,
+                       unsigned int * k0, unsigned int * k1) {
+  // The row (left) or column (right) of the triangle the element reads
+  const unsigned int d = side == tri_side::left ? i : j;
+  // Left lower and right upper keep indices up to d, the others from d on
+  if ((side == tri_side::left) == (uplo == triangle::lower)) {
+    *k0 = 0;
+    *k1 = d + 1;
+  } else {
+    *k0 = d;
+    *k1 = n;
+  }
+}
+
+// Symmetric rank-k update: a * a', or a' * a when trans is set.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_syrk(matrix<T> * a, bool trans, const epilogue<T> & ep) {
+  const typename matrix<T>::storage_type * vecs = trans ? a->_elements_col_maj : a->_elements;
+  const unsigned int n = vecs->size();
+  const unsigned int depth = trans ? a->rows : a->cols;
+
+  const auto res = new matrix<T>(n, n);
+  auto bounds = triangular_partition(n, 1, [depth](unsigned int i) { return (size_t) (i + 1) * depth; });
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++) {
+      const T * row_i = (*vecs)[i].data();
+      for (unsigned int j = 0; j <= i; j++) {
+        const T * row_j = (*vecs)[j].data();
+        decltype(T() * T()) acc = 0;
+        for (unsigned int k = 0; k < depth; k++) acc += row_i[k] * row_j[k];
+        T lower = ep.apply(acc, i, j);
+        T upper = ep.apply(acc, j, i);
+        (*res->_elements)[i][j] = lower;
+        (*res->_elements_col_maj)[j][i] = lower;
+        (*res->_elements)[j][i] = upper;
+        (*res->_elements_col_maj)[i][j] = upper;
+      }
+    }
+  }, true);
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_syrk(matrix<T> * a, bool trans = false) {
+  return matmul_syrk(a, trans, epilogue<T>());
+}
+
+// m1 * m2 where m1 (side left) or m2 (side right) is square and triangular
+// as given by uplo.  Only its uplo triangle, diagonal included, is read.
+// Note: This function is a friend of matrix - private members are used.
+template <class T>
+matrix<T> * matmul_trmm(matrix<T> * m1, matrix<T> * m2, tri_side side, triangle uplo, const epilogue<T> & ep) {
+  // Make sure that matrices match 1's cols to 2's rows
+  assert(m1->cols == m2->rows);
+  const unsigned int n = m1->cols;
+  assert(side == tri_side::left ? m1->rows == n : m2->cols == n);
+
+  const auto res = new matrix<T>(m1->rows, m2->cols);
+  auto bounds = triangular_partition(m1->rows, 1, [&](unsigned int i) {
+    if (side == tri_side::right) return (size_t) m2->cols * (n + 1) / 2;
+    unsigned int k0, k1;
+    trmm_range(side, uplo, i, 0, n, &k0, &k1);
+    return (size_t) (k1 - k0) * m2->cols;
+  });
+  parallel_ranges(bounds, [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++) {
+      const T * m1_row = (*m1->_elements)[i].data();
+      for (unsigned int j = 0; j < m2->cols; j++) {
+        const T * m2_col = (*m2->_elements_col_maj)[j].data();
+        unsigned int k0, k1;
+        trmm_range(side, uplo, i, j, n, &k0, &k1);
+        decltype(T() * T()) acc = 0;
+        for (unsigned int k = k0; k < k1; k++) acc += m1_row[k] * m2_col[k];
+        T val = ep.apply(acc, i, j);
+        (*res->_elements)[i][j] = val;
+        (*res->_elements_col_maj)[j][i] = val;
+      }
+    }
+  }, true);
+  return res;
+}
+
+template <class T>
+matrix<T> * matmul_trmm(matrix<T> * m1, matrix<T> * m2, tri_side side, triangle uplo) {
+  return matmul_trmm(m1, m2, side, uplo, epilogue<T>());
+}
+
+#endif //TRIANGULAR_H